@@ -33,6 +33,9 @@
 #include "esp_bt_device.h"
 #include "driver/gpio.h"
 #include "hid_dev.h"
+#include "../../gamepad.h"
+#include "nes.h"
+#include "sched.h"
 
 #include "driver/adc.h"
 
@@ -46,6 +49,11 @@
 
 #define BUTTON              26
 
+/* controller poll rate and how often status leds and button are handled */
+#define POLL_HZ             1000
+#define TIMER_HZ            4
+#define STATS_SECONDS       10
+
 #define LED_R               13
 #define LED_G               14
 #define LED_B               12
@@ -287,39 +295,31 @@ void app_main(void)
 	gpio_set_direction(BUTTON, GPIO_MODE_INPUT);
 	gpio_set_pull_mode(BUTTON, GPIO_PULLUP_ONLY);
 
-	/* nes/snes controller gpio */
-	gpio_set_pull_mode(NES_CLOCK, GPIO_FLOATING);
-	gpio_set_pull_mode(NES_LATCH, GPIO_FLOATING);
-	gpio_set_direction(NES_CLOCK, GPIO_MODE_OUTPUT);
-	gpio_set_level(NES_CLOCK, 0);
-	gpio_set_direction(NES_LATCH, GPIO_MODE_OUTPUT);
-	gpio_set_level(NES_LATCH, 0);
-	gpio_set_direction(NES_DATA, GPIO_MODE_INPUT);
-	gpio_set_pull_mode(NES_DATA, GPIO_PULLUP_ONLY);
+	/* nes/snes controller is read using spi peripheral */
+	if (nes_open(NES_CLOCK, NES_LATCH, NES_DATA)) {
+		ESP_LOGE(LOG_TAG, "nes controller reader init failed");
+		return;
+	}
+	if (sched_start(POLL_HZ)) {
+		ESP_LOGE(LOG_TAG, "scheduler init failed");
+		return;
+	}
 
 
 	while (true) {
-		static uint16_t btns_last = 0;
-		static uint32_t js_last = 0;
-		static int send_count = 0, timering = 0;
+		static uint8_t frame_last[GAMEPAD_FRAME_MAX];
+		static int frame_last_len = 0;
+		static int send_count = 0, timering = 0, stats_timer = 0;
+		struct gamepad_state st = { .flags = GAMEPAD_FLAG_AXES };
+		uint8_t frame[GAMEPAD_FRAME_MAX];
+		int frame_len;
 		uint16_t btns = 0;
 		uint8_t js1x = 0x80, js1y = 0x80, js2x = 0x80, js2y = 0x80;
 
-		/* read nes */
-		gpio_set_level(NES_LATCH, 1);
-		ets_delay_us(10);
-		gpio_set_level(NES_LATCH, 0);
-		ets_delay_us(5);
-		for (int i = 0; i < 8; i++) {
-			/* read button state */
-			btns |= gpio_get_level(NES_DATA) << i;
-			/* clock pulse */
-			gpio_set_level(NES_CLOCK, 1);
-			ets_delay_us(5);
-			gpio_set_level(NES_CLOCK, 0);
-			ets_delay_us(5);
-		}
-		btns = ~btns;
+		sched_wait();
+
+		/* read nes or snes, snes extras land in upper byte */
+		nes_scan(&btns);
 
 		/* convert upper buttons to joystick values */
 		if (btns & 0x10) {
@@ -337,26 +337,33 @@ void app_main(void)
 			js1y = 0x80;
 		}
 
-		/* clear btns to show only buttons */
-		btns &= 0x000f;
+		/* dpad went to joystick, pack remaining buttons: A B select start X Y L R */
+		btns = (btns & 0x000f) | ((btns >> 4) & 0x00f0);
 
 
-		/* only transmit if something changed */
-		if (btns != btns_last || js_last != ((js2x << 24) | (js2y << 16) | (js1x << 8) | js1y)) {
-			send_count = 3;
+		/* only transmit if something changed, compare in shared wire format */
+		st.buttons = btns;
+		st.axes[0] = js1x;
+		st.axes[1] = js1y;
+		st.axes[2] = js2x;
+		st.axes[3] = js2y;
+		frame_len = gamepad_encode(&st, frame);
+		/* ble link layer acknowledges and retransmits notifications, one send is enough */
+		if (frame_len != frame_last_len || memcmp(frame, frame_last, frame_len)) {
+			send_count = 1;
 		}
 		if (send_count > 0) {
-			ESP_LOGI(LOG_TAG, "send buttons %d JS1 X=%d Y=%d JS2 X=%d Y=%d", btns, js1x, js1y, js2x, js2y);
+			ESP_LOGD(LOG_TAG, "send buttons %d JS1 X=%d Y=%d JS2 X=%d Y=%d", btns, js1x, js1y, js2x, js2y);
 			esp_hidd_send_joystick_value(hid_conn_id, btns, js1x, js1y, js2x, js2y);
 			send_count--;
 		}
 
 		/* used to detect state changes which trigger sending a packet */
-		btns_last = btns;
-		js_last = ((js2x << 24) | (js2y << 16) | (js1x << 8) | js1y);
+		memcpy(frame_last, frame, frame_len);
+		frame_last_len = frame_len;
 
-		/* very simple dummy timer thingie */
-		if (timering > 250) {
+		/* slow timer for leds and button */
+		if (++timering >= POLL_HZ / TIMER_HZ) {
 			static bool toggle = 0;
 			static int btn_down = 0;
 
@@ -380,8 +387,16 @@ void app_main(void)
 
 			timering = 0;
 		}
-		timering++;
 
-		vTaskDelay(1);
+		if (++stats_timer >= POLL_HZ * STATS_SECONDS) {
+			struct nes_scan_stats ss;
+			struct sched_stats sc;
+			nes_scan_stats(&ss);
+			sched_stats(&sc);
+			ESP_LOGI(LOG_TAG, "scan: avg %u us, max %u us, jitter: avg %u us, max %u us, %u ticks missed",
+			         (uint32_t)(ss.us_total / ss.count), ss.us_max,
+			         (uint32_t)(sc.jitter_total / sc.ticks), sc.jitter_max, sc.missed);
+			stats_timer = 0;
+		}
 	}
 }
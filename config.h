@@ -31,6 +31,10 @@
 #define CFG_SPI_SCLK        GPIO_NUM_14
 #define CFG_NRF_SS          GPIO_NUM_26
 #define CFG_NRF_CE          GPIO_NUM_27
+/* nes controller, data needs internal pull-up which input only pins 34-39 do not have */
+#define GPIO_NES_CLOCK      GPIO_NUM_32
+#define GPIO_NES_LATCH      GPIO_NUM_33
+#define GPIO_NES_INPUT      GPIO_NUM_25
 #endif
 
 #ifdef TARGET_PIC8
@@ -51,3 +55,48 @@
 #define GPIO_NES_LATCH      1
 #define GPIO_NES_INPUT      5
 #endif
+
+/* controller id, each controller sharing one receiver needs its own */
+#ifndef CFG_CONTROLLER_ID
+#define CFG_CONTROLLER_ID   0
+#endif
+
+/* rx pipes receiver listens on, same as its --pipes, controllers past these share pipe 0 */
+#ifndef CFG_RX_PIPES
+#define CFG_RX_PIPES        6
+#endif
+
+/* how many times each frame is sent, receiver drops copies by sequence number */
+#ifndef CFG_SEND_REPEAT
+#define CFG_SEND_REPEAT     1
+#endif
+
+/* previous transitions carried in each frame, lost frames are recovered from these */
+#ifndef CFG_HISTORY
+#define CFG_HISTORY         3
+#endif
+
+/* while nothing changes last frame is resent this often so receiver knows controller is there */
+#ifndef CFG_KEEPALIVE_MS
+#define CFG_KEEPALIVE_MS    100
+#endif
+
+/* controller scan time budget in microseconds, longer scans are warned about */
+#ifndef CFG_SCAN_BUDGET_US
+#define CFG_SCAN_BUDGET_US  50
+#endif
+
+/* controller poll rate in Hz, from 125 to 2000 */
+#ifndef CFG_POLL_HZ
+#define CFG_POLL_HZ         1000
+#endif
+
+/* seconds between scan time and jitter reports */
+#ifndef CFG_REPORT_SECONDS
+#define CFG_REPORT_SECONDS  10
+#endif
+
+/* frequency hopping sequence seed, receiver must use same, 0 stays on fixed channel */
+#ifndef CFG_HOP_SEED
+#define CFG_HOP_SEED        0
+#endif
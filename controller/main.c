@@ -9,17 +9,93 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <libe/os.h>
 #include <libe/log.h>
 #include <libe/drivers/misc/broadcast.h>
 #include <libe/drivers/spi/nrf.h>
 #include "../gamepad.h"
 #include "../config.h"
+#include "../pad/nes.h"
+#include "../pad/sched.h"
+#ifdef USE_SPI
+#include "../radio.h"
+#include "../hop.h"
+#endif
+#ifdef TARGET_ESP32
+#include <esp_timer.h>
+#endif
 
 
 struct spi_master master;
 struct nrf_device nrf;
 
+/* previous states sent along with each frame and when they were entered */
+static struct gamepad_history history[GAMEPAD_HISTORY_MAX];
+static uint32_t history_time[GAMEPAD_HISTORY_MAX];
+static int history_count = 0;
+
+#if defined(USE_SPI) && CFG_HOP_SEED
+/* receiver channel sequence, followed by trying next channels when frames are not acknowledged */
+static struct hop hop;
+/* time in milliseconds counted from scheduler ticks, every target has those */
+static uint32_t hop_ms = 0;
+static uint32_t hop_ms_frac = 0;
+#endif
+
+
+/* monotonic time in 100 us units */
+static uint32_t time_100us(void)
+{
+#ifdef TARGET_ESP32
+	return (uint32_t)(esp_timer_get_time() / 100);
+#elif defined(TARGET_X86) || defined(TARGET_RPI)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 10000 + ts.tv_nsec / 100000);
+#else
+	/* no clock, receiver still gets the order right */
+	return 0;
+#endif
+}
+
+/* push state that is being replaced into history */
+static void history_push(uint16_t buttons, uint32_t entered)
+{
+	for (int i = GAMEPAD_HISTORY_MAX - 1; i > 0; i--) {
+		history[i] = history[i - 1];
+		history_time[i] = history_time[i - 1];
+	}
+	history[0].buttons = buttons;
+	history_time[0] = entered;
+	if (history_count < GAMEPAD_HISTORY_MAX) {
+		history_count++;
+	}
+}
+
+
+#ifdef USE_SPI
+/* send one frame, with hopping it is also how receiver is followed */
+static void send_frame(const uint8_t *frame, int len)
+{
+#if CFG_HOP_SEED
+	for (int i = 0; i < HOP_TRIES; i++) {
+		uint8_t ack[RADIO_PAYLOAD_SIZE];
+		int n = radio_send_wait_ack(&nrf, frame, len, ack);
+		if (n >= 0) {
+			/* receiver tells its position and blacklist in acknowledgement */
+			hop_heard(&hop, ack, n, hop_ms);
+			return;
+		}
+		/* receiver moved on or frame was lost, try where receiver can be, search continues on next send */
+		nrf_set_channel(&nrf, hop_missed(&hop, hop_ms));
+	}
+#else
+	/* auto-ack is on, unacknowledged frame must be cleared or radio stops sending */
+	radio_send_wait(&nrf, frame, len);
+#endif
+}
+#endif
 
 void p_exit(int return_code)
 {
@@ -32,6 +108,8 @@ void p_exit(int return_code)
 	nrf_disable_radio(&nrf);
 	spi_master_close(&master);
 #endif
+	sched_stop();
+	nes_close();
 	log_quit();
 	os_quit();
 	exit(return_code);
@@ -45,19 +123,6 @@ int p_init(int argc, char *argv[])
 	/* debug/log init */
 	log_init(NULL, 0);
 
-	os_gpio_output(18);
-	// os_gpio_high(18);
-	// while(1);
-	os_gpio_input(17);
-	while (1) {
-		if (os_gpio_read(17)) {
-			os_gpio_low(18);
-		} else {
-			os_gpio_high(18);
-		}
-		// os_delay_ms(300);
-	}
-
 	/* initialize spi master */
 #ifdef USE_FTDI
 	ERROR_IF_R(common_ftdi_init(), -1, "need to have nrf device connected to ftdi");
@@ -75,12 +140,24 @@ int p_init(int argc, char *argv[])
 	/* nrf initialization */
 	ERROR_IF_R(nrf_open(&nrf, &master, CFG_NRF_SS, CFG_NRF_CE), -1, "nrf24l01+ failed to initialize");
 	/* change channel, default is 70 */
-	nrf_set_channel(&nrf, 17);
+#if CFG_HOP_SEED
+	hop_init(&hop, CFG_HOP_SEED);
+	nrf_set_channel(&nrf, hop_channel(&hop));
+#else
+	nrf_set_channel(&nrf, RADIO_CHANNEL);
+#endif
 	/* change speed, default is 250k */
-	nrf_set_speed(&nrf, NRF_SPEED_2M);
-	/* enable radio in listen mode */
-	nrf_mode_rx(&nrf);
-	nrf_flush_rx(&nrf);
+	radio_data_rate(&nrf, RADIO_DATA_RATE);
+	/* send to pipe reserved for this controller, others share pipe 0 and receiver uses id in frame */
+#if CFG_CONTROLLER_ID < CFG_RX_PIPES && CFG_CONTROLLER_ID < RADIO_PIPES
+	radio_tx_pipe(&nrf, CFG_CONTROLLER_ID);
+#else
+	INFO_MSG("controller id %d has no own pipe, sharing pipe 0", CFG_CONTROLLER_ID);
+	radio_tx_pipe(&nrf, 0);
+#endif
+	/* enable radio in transmit mode */
+	nrf_mode_tx(&nrf);
+	nrf_flush_tx(&nrf);
 	nrf_enable_radio(&nrf);
 #endif
 
@@ -105,60 +182,99 @@ int main(int argc, char *argv[])
 	}
 
 	/* init nes controller */
-	os_gpio_output(GPIO_NES_CLOCK); /* clock */
-	os_gpio_low(GPIO_NES_CLOCK);
-	os_gpio_output(GPIO_NES_LATCH); /* latch */
-	os_gpio_low(GPIO_NES_LATCH);
-	os_gpio_input(GPIO_NES_INPUT); /* data */
-
-	// while (1) {
-	// 	os_gpio_high(GPIO_NES_CLOCK);
-	// 	os_gpio_high(GPIO_NES_LATCH);
-	// 	os_delay_ms(300);
-	// 	os_gpio_low(GPIO_NES_CLOCK);
-	// 	os_gpio_low(GPIO_NES_LATCH);
-	// 	os_delay_ms(300);
-	// }
+	if (nes_open(GPIO_NES_CLOCK, GPIO_NES_LATCH, GPIO_NES_INPUT)) {
+		CRIT_MSG("unable to open nes controller reader");
+		p_exit(EXIT_FAILURE);
+	}
+
+	/* sample at fixed rate, input age at send is then at most one period plus scan */
+	if (sched_start(CFG_POLL_HZ)) {
+		CRIT_MSG("unable to start scheduler at %d Hz", CFG_POLL_HZ);
+		p_exit(EXIT_FAILURE);
+	}
 
 	/* start program loop */
-	INFO_MSG("starting program loop");
+	INFO_MSG("starting program loop, polling at %d Hz", CFG_POLL_HZ);
 	while (1) {
 		static uint16_t b_prev = 0xffff;
-		uint16_t b = 0xff00;
-
-		/* read nes, latch pulse first */
-		os_gpio_high(GPIO_NES_LATCH);
-		os_delay_us(10);
-		os_gpio_low(GPIO_NES_LATCH);
-		os_delay_us(10);
-
-		for (int i = 0; i < 8; i++) {
-			/* read button state */
-			b |= os_gpio_read(GPIO_NES_INPUT) << i;
-			/* clock pulse */
-			os_gpio_high(GPIO_NES_CLOCK);
-			os_delay_us(10);
-			os_gpio_low(GPIO_NES_CLOCK);
-			os_delay_us(10);
+		static int type_prev = NES_TYPE_NONE;
+		static uint32_t ticks = 0;
+		static uint8_t frame[GAMEPAD_FRAME_MAX];
+		static int len = 0;
+		static uint32_t idle = 0;
+		uint16_t b;
+		int type;
+
+#if defined(USE_SPI) && CFG_HOP_SEED
+		/* ticks missed passed too, receiver dwell times are followed by this */
+		hop_ms_frac += (uint32_t)(1 + sched_wait()) * 1000;
+		hop_ms += hop_ms_frac / CFG_POLL_HZ;
+		hop_ms_frac %= CFG_POLL_HZ;
+#else
+		sched_wait();
+#endif
+
+		/* read nes or snes, type can change if controller is swapped */
+		type = nes_scan(&b);
+		if (type != type_prev) {
+			INFO_MSG("controller type changed to %s", type == NES_TYPE_NES ? "nes" : (type == NES_TYPE_SNES ? "snes" : "none"));
+			type_prev = type;
+		}
+
+		/* keep an eye on scan time and jitter, they add directly to latency */
+		if (++ticks >= CFG_POLL_HZ * CFG_REPORT_SECONDS) {
+			struct nes_scan_stats ss;
+			struct sched_stats sc;
+			nes_scan_stats(&ss);
+			sched_stats(&sc);
+			if (ss.us_max > CFG_SCAN_BUDGET_US) {
+				WARN_MSG("scan time over budget: min %u us, avg %u us, max %u us, budget %u us",
+				         ss.us_min, (uint32_t)(ss.us_total / ss.count), ss.us_max, CFG_SCAN_BUDGET_US);
+			} else {
+				INFO_MSG("scan time: min %u us, avg %u us, max %u us", ss.us_min, (uint32_t)(ss.us_total / ss.count), ss.us_max);
+			}
+			INFO_MSG("jitter: min %u us, avg %u us, max %u us, busy: avg %u us, max %u us, %u/%u ticks missed",
+			         sc.jitter_min, (uint32_t)(sc.jitter_total / sc.ticks), sc.jitter_max,
+			         (uint32_t)(sc.busy_total / sc.ticks), sc.busy_max, sc.missed, sc.ticks + sc.missed);
+			ticks = 0;
 		}
-		b = ~b;
-		printf("buttons: %02x\r\n", b);
 
 		/* send only if changed */
 		if (b != b_prev) {
-			struct gamepad_packet pck;
-			memcpy(pck.magic, "gamepad\0", 8);
-			pck.button = b;
-			// pck.gamepad.buttons[1] = 0xffff;
-			// pck.gamepad.buttons[2] = 0xffff;
-			// pck.gamepad.buttons[3] = 0xffff;
-// #ifdef USE_SPI
-// 			nrf_send(&nrf, &pck);
-// 			os_delay_us(100);
-// 			nrf_send(&nrf, &pck);
-// #endif
+			static struct gamepad_state st = { .id = CFG_CONTROLLER_ID, .flags = GAMEPAD_FLAG_HISTORY };
+			static uint32_t t_entered = 0;
+			uint32_t t = time_100us();
+
+			/* previous transitions ride along so receiver can recover lost frames */
+			if (b_prev != 0xffff) {
+				history_push(st.buttons, t_entered);
+			}
+			st.history_count = history_count < CFG_HISTORY ? history_count : CFG_HISTORY;
+			for (int i = 0; i < st.history_count; i++) {
+				uint32_t age = t - history_time[i];
+				st.history[i].buttons = history[i].buttons;
+				st.history[i].age = age > 0xffff ? 0xffff : age;
+			}
+			t_entered = t;
+
+			st.seq++;
+			st.buttons = b;
+			len = gamepad_encode(&st, frame);
+#ifdef USE_SPI
+			/* copies share sequence number so receiver applies only one */
+			for (int i = 0; i < CFG_SEND_REPEAT; i++) {
+				send_frame(frame, len);
+				os_delay_us(100);
+			}
+#endif
 			b_prev = b;
-			printf("buttons changed: %02x\r\n", b);
+			idle = 0;
+		} else if (len > 0 && ++idle >= (uint32_t)CFG_POLL_HZ * CFG_KEEPALIVE_MS / 1000) {
+			/* keepalive is a copy of last frame, receiver drops it as duplicate */
+#ifdef USE_SPI
+			send_frame(frame, len);
+#endif
+			idle = 0;
 		}
 	}
 
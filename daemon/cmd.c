@@ -6,10 +6,15 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libgen.h>
 #include <errno.h>
+#include <sched.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <libe/log.h>
 #include <libe/os.h>
 #include <libe/broadcast.h>
@@ -36,6 +41,15 @@ int reset = 0;
 uint16_t broadcast_port = 0;
 #endif
 
+/* real-time priority, 0 for normal scheduling */
+static int rt_prio = 0;
+/* lock and prefault memory */
+static int rt_mlock = 0;
+
+/* prefaulted memory, enough for everything the daemon allocates */
+#define RT_PREFAULT_STACK   (256 * 1024)
+#define RT_PREFAULT_HEAP    (8 * 1024 * 1024)
+
 void common_help(int argc, char *argv[])
 {
 	printf(
@@ -61,6 +75,8 @@ void common_help(int argc, char *argv[])
 	    "  -R, --reset                do usb reset on the device at start\n"
 	    "  -L, --list-devices         list all devices found\n"
 #endif
+	    "      --rt=PRIO              run with SCHED_FIFO real-time priority PRIO (1-99)\n"
+	    "      --mlock                lock and prefault all memory so it is never paged out\n"
 	    "\n"
 	    , basename(argv[0]));
 	p_help();
@@ -85,6 +101,16 @@ int common_options(int argc, char *argv[], const char opts[], struct option long
 		}
 		/* check for common options */
 		switch (c) {
+		case COMMON_OPT_RT:
+			rt_prio = atoi(optarg);
+			if (rt_prio < sched_get_priority_min(SCHED_FIFO) || rt_prio > sched_get_priority_max(SCHED_FIFO)) {
+				ERROR_MSG("invalid real-time priority");
+				p_exit(1);
+			}
+			break;
+		case COMMON_OPT_MLOCK:
+			rt_mlock = 1;
+			break;
 #ifdef USE_FTDI
 		case 'V':
 			i = (int)strtol(optarg, NULL, 16);
@@ -196,3 +222,99 @@ int common_broadcast_init(void)
 }
 
 #endif
+
+/* touch stack pages now so that deep call later does not fault */
+static void __attribute__((noinline)) rt_prefault_stack(void)
+{
+	volatile uint8_t stack[RT_PREFAULT_STACK];
+	for (size_t i = 0; i < sizeof(stack); i += 4096) {
+		stack[i] = 0;
+	}
+}
+
+int common_rt_init(void)
+{
+	if (rt_mlock) {
+		uint8_t *heap;
+
+		ERROR_IF_R(mlockall(MCL_CURRENT | MCL_FUTURE), -1, "mlockall() failed: %s", strerror(errno));
+		/* freed memory stays in process instead of going back to kernel */
+		mallopt(M_TRIM_THRESHOLD, -1);
+		mallopt(M_MMAP_MAX, 0);
+		heap = malloc(RT_PREFAULT_HEAP);
+		ERROR_IF_R(!heap, -1, "unable to allocate memory for prefaulting");
+		for (size_t i = 0; i < RT_PREFAULT_HEAP; i += 4096) {
+			heap[i] = 0;
+		}
+		free(heap);
+		rt_prefault_stack();
+	}
+
+	if (rt_prio > 0) {
+		struct sched_param param;
+		int err;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_prio;
+		err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		ERROR_IF_R(err, -1, "unable to set SCHED_FIFO priority %d: %s", rt_prio, strerror(err));
+	}
+
+	return 0;
+}
+
+int common_rt_mlocked(void)
+{
+	return rt_mlock;
+}
+
+int common_rt_check(const char *name, pthread_t thread, int cpu)
+{
+	static int memory_checked = 0;
+	struct sched_param param;
+	cpu_set_t set;
+	int policy, ok = 0;
+
+	if (pthread_getschedparam(thread, &policy, &param) == 0) {
+		if (rt_prio > 0 && (policy != SCHED_FIFO || param.sched_priority != rt_prio)) {
+			WARN_MSG("%s: scheduling is %s priority %d, wanted SCHED_FIFO priority %d",
+			         name, policy == SCHED_FIFO ? "SCHED_FIFO" : "not real-time", param.sched_priority, rt_prio);
+			ok = -1;
+		} else {
+			INFO_MSG("%s: scheduling %s priority %d", name, policy == SCHED_FIFO ? "SCHED_FIFO" : "normal", param.sched_priority);
+		}
+	}
+
+	if (cpu >= 0 && pthread_getaffinity_np(thread, sizeof(set), &set) == 0) {
+		if (CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set)) {
+			WARN_MSG("%s: not pinned to cpu %d, runs on %d cpus", name, cpu, CPU_COUNT(&set));
+			ok = -1;
+		} else {
+			INFO_MSG("%s: pinned to cpu %d", name, cpu);
+		}
+	}
+
+	/* memory locking is process wide, kernel tells how much is locked */
+	if (rt_mlock && !memory_checked) {
+		char line[128];
+		long locked = -1;
+		FILE *f = fopen("/proc/self/status", "r");
+		while (f && fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "VmLck: %ld", &locked) == 1) {
+				break;
+			}
+		}
+		if (f) {
+			fclose(f);
+		}
+		if (locked < RT_PREFAULT_HEAP / 1024) {
+			WARN_MSG("%s: only %ld kB of memory locked", name, locked);
+			ok = -1;
+		} else {
+			INFO_MSG("%s: %ld kB of memory locked", name, locked);
+		}
+		memory_checked = 1;
+	}
+
+	return ok;
+}
@@ -9,6 +9,7 @@
 #define _CMD_COMMON_H__
 
 #include <getopt.h>
+#include <pthread.h>
 #ifdef USE_FTDI
 #include <libftdi1/ftdi.h>
 #endif
@@ -18,9 +19,18 @@ extern "C" {
 #endif
 
 
+/* long only common options, command specific ones start from 0x100 */
+#define COMMON_OPT_RT       0x80
+#define COMMON_OPT_MLOCK    0x81
+
+#define COMMON_RT_LONG_OPTS \
+    { "rt", required_argument, NULL, COMMON_OPT_RT }, \
+    { "mlock", no_argument, NULL, COMMON_OPT_MLOCK },
+
 #ifdef USE_FTDI
 #define COMMON_SHORT_OPTS "hV:P:D:S:I:RL"
 #define COMMON_LONG_OPTS \
+    COMMON_RT_LONG_OPTS \
     { "help", no_argument, NULL, 'h' }, \
     { "vid", required_argument, NULL, 'V' }, \
     { "pid", required_argument, NULL, 'P' }, \
@@ -32,6 +42,7 @@ extern "C" {
 #else
 #define COMMON_SHORT_OPTS "h"
 #define COMMON_LONG_OPTS \
+    COMMON_RT_LONG_OPTS \
     { "help", no_argument, NULL, 'h' },
 #endif
 
@@ -77,6 +88,31 @@ int common_ftdi_init(void);
 
 int common_broadcast_init(void);
 
+/**
+ * Apply real-time options to calling thread and process: scheduling
+ * class, memory locking and prefaulting. Threads created after this
+ * inherit scheduling class.
+ *
+ * @return          0 on success, -1 on errors
+ */
+int common_rt_init(void);
+
+/**
+ * Check if memory locking was requested, mappings made after
+ * common_rt_init() are then locked too.
+ */
+int common_rt_mlocked(void);
+
+/**
+ * Log whether real-time settings took effect on given thread.
+ *
+ * @param  name     name of thread in log
+ * @param  thread   thread to check
+ * @param  cpu      cpu thread was pinned to, -1 if none
+ * @return          0 if everything requested is in effect, -1 if not
+ */
+int common_rt_check(const char *name, pthread_t thread, int cpu);
+
 
 #ifdef __cplusplus
 }
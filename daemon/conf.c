@@ -0,0 +1,129 @@
+/*
+ * Gamepad daemon configuration file
+ *
+ * Whole file is parsed before anything is applied, so a file with an
+ * error leaves running settings as they were.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <libe/log.h>
+#include "conf.h"
+
+
+static char *conf_trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) {
+		*--end = '\0';
+	}
+	return s;
+}
+
+static int conf_int(const char *value, int min, int max)
+{
+	char *end;
+	long v = strtol(value, &end, 0);
+
+	if (end == value || *end != '\0' || v < min || v > max) {
+		return -1;
+	}
+	return (int)v;
+}
+
+int conf_channel(const char *value)
+{
+	return conf_int(value, 0, 125);
+}
+
+int conf_data_rate(const char *value)
+{
+	int v = conf_int(value, 250, 2000);
+	return v == 250 || v == 1000 || v == 2000 ? v : -1;
+}
+
+static int conf_line(struct conf *conf, const char *key, const char *value)
+{
+	int v;
+
+	if (strcmp(key, "channel") == 0) {
+		ERROR_IF_R((v = conf_channel(value)) < 0, -1, "invalid channel %s", value);
+		conf->channel = v;
+	} else if (strcmp(key, "data-rate") == 0) {
+		ERROR_IF_R((v = conf_data_rate(value)) < 0, -1, "invalid data rate %s", value);
+		conf->data_rate = v;
+	} else if (strcmp(key, "deadzone") == 0) {
+		ERROR_IF_R((v = conf_int(value, 0, 127)) < 0, -1, "invalid deadzone %s", value);
+		conf->deadzone = v;
+	} else if (strcmp(key, "hysteresis") == 0) {
+		ERROR_IF_R((v = conf_int(value, 0, 255)) < 0, -1, "invalid hysteresis %s", value);
+		conf->hysteresis = v;
+	} else if (strcmp(key, "keymap") == 0) {
+		return keymap_edit(conf->keymaps, value);
+	} else {
+		ERROR_MSG("unknown setting %s", key);
+		return -1;
+	}
+
+	return 0;
+}
+
+int conf_load(const char *file, struct conf *conf)
+{
+	char buf[256];
+	int line = 0, err = 0;
+	FILE *fp;
+
+	conf->keymaps = NULL;
+	fp = fopen(file, "r");
+	ERROR_IF_R(!fp, -1, "unable to open %s: %s", file, strerror(errno));
+	conf->keymaps = keymap_new();
+	if (!conf->keymaps) {
+		fclose(fp);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		char *key, *value, *p;
+
+		line++;
+		if ((p = strchr(buf, '#'))) {
+			*p = '\0';
+		}
+		key = conf_trim(buf);
+		if (*key == '\0') {
+			continue;
+		}
+		p = strchr(key, '=');
+		if (!p) {
+			ERROR_MSG("%s:%d: expected key = value", file, line);
+			err = -1;
+			continue;
+		}
+		*p = '\0';
+		key = conf_trim(key);
+		value = conf_trim(p + 1);
+		if (conf_line(conf, key, value)) {
+			ERROR_MSG("%s:%d: invalid line", file, line);
+			err = -1;
+		}
+	}
+	fclose(fp);
+
+	if (err) {
+		free(conf->keymaps);
+		conf->keymaps = NULL;
+	}
+	return err;
+}
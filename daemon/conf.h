@@ -0,0 +1,48 @@
+/*
+ * Gamepad daemon configuration file
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _CONF_H_
+#define _CONF_H_
+
+#include "keymap.h"
+
+/* settings that can be changed while running */
+struct conf {
+	/* radio */
+	int channel;
+	int data_rate;
+	/* analog axis filtering */
+	int deadzone;
+	int hysteresis;
+	/* mapping, built from command line selections */
+	struct keymap_table *keymaps;
+};
+
+/**
+ * Load configuration file over given settings.
+ *
+ * File has one "key = value" per line, keys are same as long command
+ * line options: channel, data-rate, deadzone, hysteresis and keymap,
+ * which can be given multiple times. Text after # is ignored.
+ *
+ * @param  file     configuration file
+ * @param  conf     settings to modify, keymaps is allocated here
+ * @return          0 on success, -1 on errors and then keymaps is NULL
+ */
+int conf_load(const char *file, struct conf *conf);
+
+/**
+ * Check radio channel, 0-125.
+ */
+int conf_channel(const char *value);
+
+/**
+ * Check radio air data rate, 250, 1000 or 2000 kbps.
+ */
+int conf_data_rate(const char *value);
+
+#endif /* _CONF_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Gamepad daemon per controller duplicate filter
+ *
+ * Controllers send state changes more than once, each copy with the
+ * same sequence number. A sliding window of seen sequence numbers
+ * drops the copies, counts gaps as loss and rejects frames that
+ * arrive after a newer one. A controller that restarts is noticed by
+ * its sequence numbers going back or far ahead after a quiet period.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <libe/log.h>
+#include "dedup.h"
+#include "gdd.h"
+
+
+static struct dedup dedups[GDD_MAX];
+
+
+static int dedup_restart(struct dedup *d, uint8_t seq, uint64_t now)
+{
+	d->last = seq;
+	d->window = 1;
+	d->t_accept = now;
+	d->resyncs++;
+	d->accepted++;
+	return DEDUP_ACCEPT;
+}
+
+int dedup_check(uint8_t id, uint8_t seq, uint64_t now, int *missed)
+{
+	struct dedup *d = &dedups[id];
+	int diff;
+
+	*missed = 0;
+	if (!d->valid) {
+		d->valid = 1;
+		d->last = seq;
+		d->window = 1;
+		d->t_accept = now;
+		d->accepted++;
+		return DEDUP_ACCEPT;
+	}
+
+	/* sequence numbers wrap, difference is signed */
+	diff = (int8_t)(uint8_t)(seq - d->last);
+	/* keepalives are copies of newest frame, anything else this late is a new numbering */
+	if (diff != 0 && (diff < 0 || diff >= DEDUP_WINDOW) && now - d->t_accept >= DEDUP_RESTART_MS * 1000000ULL) {
+		return dedup_restart(d, seq, now);
+	}
+	if (diff > 0) {
+		*missed = diff - 1;
+		d->lost += diff - 1;
+		d->window = diff < DEDUP_WINDOW ? (d->window << diff) | 1 : 1;
+		d->last = seq;
+		d->t_accept = now;
+		d->accepted++;
+		return DEDUP_ACCEPT;
+	} else if (diff == 0) {
+		d->duplicates++;
+		return DEDUP_DUPLICATE;
+	} else if (-diff < DEDUP_WINDOW) {
+		if (d->window & (1UL << -diff)) {
+			d->duplicates++;
+			return DEDUP_DUPLICATE;
+		}
+		/* never seen, but newer state has already been applied */
+		d->reordered++;
+		return DEDUP_OLD;
+	}
+
+	/* far behind, controller has most likely restarted */
+	return dedup_restart(d, seq, now);
+}
+
+void dedup_recovered(uint8_t id, int count)
+{
+	dedups[id].recovered += count;
+}
+
+void dedup_reset(uint8_t id)
+{
+	/* counters are kept for totals */
+	dedups[id].valid = 0;
+	dedups[id].window = 0;
+}
+
+const struct dedup *dedup_get(uint8_t id)
+{
+	return &dedups[id];
+}
+
+void dedup_print(void)
+{
+	uint64_t accepted = 0, duplicates = 0, lost = 0, recovered = 0, reordered = 0, resyncs = 0;
+
+	for (int i = 0; i < GDD_MAX; i++) {
+		accepted += dedups[i].accepted;
+		duplicates += dedups[i].duplicates;
+		lost += dedups[i].lost;
+		recovered += dedups[i].recovered;
+		reordered += dedups[i].reordered;
+		resyncs += dedups[i].resyncs;
+	}
+	INFO_MSG("frames: %llu accepted, %llu duplicates dropped, %llu lost (%llu recovered from history), %llu out of order, %llu resyncs",
+	         (unsigned long long)accepted, (unsigned long long)duplicates, (unsigned long long)lost,
+	         (unsigned long long)recovered, (unsigned long long)reordered, (unsigned long long)resyncs);
+}
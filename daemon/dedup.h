@@ -0,0 +1,77 @@
+/*
+ * Gamepad daemon per controller duplicate filter
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdint.h>
+
+/* how many previous sequence numbers are remembered */
+#define DEDUP_WINDOW        32
+/* older frames are rejected only this long after last accepted one */
+#define DEDUP_RESTART_MS    1000
+
+enum {
+	DEDUP_ACCEPT = 0,   /* new frame */
+	DEDUP_DUPLICATE,    /* copy of already seen frame */
+	DEDUP_OLD,          /* out of order frame older than newest seen */
+};
+
+struct dedup {
+	uint8_t valid;
+	uint8_t last;
+	/* bit n set if sequence number last - n has been seen */
+	uint32_t window;
+	/* when last frame was accepted, in nanoseconds */
+	uint64_t t_accept;
+
+	uint32_t accepted;
+	uint32_t duplicates;
+	uint32_t lost;
+	uint32_t recovered;
+	uint32_t reordered;
+	uint32_t resyncs;
+};
+
+/**
+ * Check frame sequence number of given controller.
+ * Only receiver thread may call this.
+ *
+ * Controller that restarts numbers its frames from start again. When
+ * nothing has been accepted for DEDUP_RESTART_MS, a frame behind the
+ * newest one or far ahead of window is taken as such a restart instead
+ * of dropping it or counting the jump as loss.
+ *
+ * @param  id       controller id
+ * @param  seq      sequence number from frame
+ * @param  now      receive time in nanoseconds
+ * @param  missed   number of frames missed before this one, when accepted
+ * @return          DEDUP_ACCEPT if frame should be processed
+ */
+int dedup_check(uint8_t id, uint8_t seq, uint64_t now, int *missed);
+
+/**
+ * Mark missed frames of given controller as recovered from frame history.
+ */
+void dedup_recovered(uint8_t id, int count);
+
+/**
+ * Forget sequence state of given controller, counters are kept.
+ */
+void dedup_reset(uint8_t id);
+
+/**
+ * Get filter state of given controller.
+ */
+const struct dedup *dedup_get(uint8_t id);
+
+/**
+ * Log totals over all controllers.
+ */
+void dedup_print(void);
+
+#endif /* _DEDUP_H_ */
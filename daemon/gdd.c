@@ -11,50 +11,89 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <linux/uinput.h>
 #include <libe/log.h>
 #include <libe/linkedlist.h>
 #include "gdd.h"
+#include "keymap.h"
+#include "metrics.h"
+#include "../gamepad.h"
 
 
 static struct gdd *gdd_first;
 static struct gdd *gdd_last;
 
+/* device objects are pooled, slot table maps controller id to device */
+static struct gdd gdd_pool[GDD_MAX];
+static struct gdd *gdd_free;
+static struct gdd *gdd_slots[GDD_MAX];
 
-int gdd_init(void)
-{
-	return 0;
-}
+/*
+ * Uinput devices created at start and not bound to any controller.
+ * Device a controller was last bound to is its home, so reconnecting
+ * controller gets the same evdev node back.
+ */
+static struct gdd *gdd_ready_first;
+static struct gdd *gdd_ready_last;
+static struct gdd *gdd_home[GDD_MAX];
+static int gdd_prealloc = 0;
 
-void gdd_quit(void)
-{
-}
+/* original reader wrote eight buttons and sync one event per write */
+#define GDD_UNBATCHED_WRITES    9
 
-struct gdd *gdd_create(uint32_t id, uint8_t type)
+/* left stick and right stick */
+static const uint16_t gdd_axis_codes[GDD_AXES] = {
+	ABS_X,
+	ABS_Y,
+	ABS_RX,
+	ABS_RY,
+};
+
+/* set by receiver on reload while emitter filters */
+static atomic_int gdd_deadzone = 8;
+static atomic_int gdd_hysteresis = 2;
+
+
+/* open and create uinput device, keys NULL enables keys of all profiles */
+static int gdd_open(const char *phys, uint8_t type, const uint16_t *keys)
 {
-	struct gdd *gdd;
 	struct uinput_setup usetup;
 	int fd;
 
-	for (gdd = gdd_first; gdd; gdd = gdd->next) {
-		if (gdd->id == id) {
-			return gdd;
+	fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	ERROR_IF_R(fd < 0, -1, "failed to create new uinput device");
+
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	for (int k = 0; k < KEYMAP_COUNT; k++) {
+		const uint16_t *codes = keys ? keys : keymap_codes(k);
+		for (int i = 0; i < GDD_BUTTONS; i++) {
+			ioctl(fd, UI_SET_KEYBIT, codes[i]);
+		}
+		if (keys) {
+			break;
 		}
 	}
 
-	fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
-	ERROR_IF_R(fd < 0, NULL, "failed to create new uinput device");
+	/* 8 bit axes, centered at start */
+	if (type & GDD_TYPE_AXES) {
+		ioctl(fd, UI_SET_EVBIT, EV_ABS);
+		for (int i = 0; i < GDD_AXES; i++) {
+			struct uinput_abs_setup abs;
+			memset(&abs, 0, sizeof(abs));
+			abs.code = gdd_axis_codes[i];
+			abs.absinfo.value = GAMEPAD_AXIS_CENTER;
+			abs.absinfo.minimum = 0;
+			abs.absinfo.maximum = 255;
+			abs.absinfo.flat = atomic_load_explicit(&gdd_deadzone, memory_order_relaxed);
+			ioctl(fd, UI_SET_ABSBIT, gdd_axis_codes[i]);
+			ioctl(fd, UI_ABS_SETUP, &abs);
+		}
+	}
 
-	/* enable the device */
-	ioctl(fd, UI_SET_EVBIT, EV_KEY);
-	ioctl(fd, UI_SET_KEYBIT, BTN_A);
-	ioctl(fd, UI_SET_KEYBIT, BTN_B);
-	ioctl(fd, UI_SET_KEYBIT, BTN_SELECT);
-	ioctl(fd, UI_SET_KEYBIT, BTN_START);
-	ioctl(fd, UI_SET_KEYBIT, BTN_DPAD_UP);
-	ioctl(fd, UI_SET_KEYBIT, BTN_DPAD_DOWN);
-	ioctl(fd, UI_SET_KEYBIT, BTN_DPAD_LEFT);
-	ioctl(fd, UI_SET_KEYBIT, BTN_DPAD_RIGHT);
+	/* physical path stays same for same slot so udev rules can match it */
+	ioctl(fd, UI_SET_PHYS, phys);
 
 	/* setup and create */
 	memset(&usetup, 0, sizeof(usetup));
@@ -63,72 +102,299 @@ struct gdd *gdd_create(uint32_t id, uint8_t type)
 	usetup.id.product = 0x7777;
 	strcpy(usetup.name, "Duge's gamepad");
 	ioctl(fd, UI_DEV_SETUP, &usetup);
-	ioctl(fd, UI_DEV_CREATE);
+	if (ioctl(fd, UI_DEV_CREATE) < 0) {
+		ERROR_MSG("failed to create uinput device %s", phys);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void gdd_close(struct gdd *gdd)
+{
+	ioctl(gdd->fd, UI_DEV_DESTROY);
+	close(gdd->fd);
+	gdd->fd = -1;
+	gdd->next = gdd_free;
+	gdd_free = gdd;
+}
 
-	/* allocate device and fill data */
-	SALLOC(gdd, NULL);
+int gdd_init(int prealloc)
+{
+	gdd_free = NULL;
+	for (int i = GDD_MAX - 1; i >= 0; i--) {
+		gdd_pool[i].next = gdd_free;
+		gdd_free = &gdd_pool[i];
+	}
+	memset(gdd_slots, 0, sizeof(gdd_slots));
+	memset(gdd_home, 0, sizeof(gdd_home));
+	gdd_ready_first = gdd_ready_last = NULL;
+	ERROR_IF_R(prealloc < 0 || prealloc > GDD_MAX, -1, "invalid device pool size %d", prealloc);
+
+	/*
+	 * Pooled devices can be bound to any controller, so they have keys
+	 * of all profiles and axes. Binding is then only pointer updates.
+	 */
+	for (gdd_prealloc = 0; gdd_prealloc < prealloc; gdd_prealloc++) {
+		struct gdd *gdd = gdd_free;
+		char phys[32];
+		int fd;
+		snprintf(phys, sizeof(phys), "gamepadd/pool%d", gdd_prealloc);
+		fd = gdd_open(phys, GDD_TYPE_AXES, NULL);
+		ERROR_IF_R(fd < 0, -1, "failed to create device pool");
+		gdd_free = gdd->next;
+		memset(gdd, 0, sizeof(*gdd));
+		gdd->fd = fd;
+		gdd->pooled = 1;
+		gdd->type = GDD_TYPE_AXES;
+		memset(gdd->axes, GAMEPAD_AXIS_CENTER, sizeof(gdd->axes));
+		LL_APP(gdd_ready_first, gdd_ready_last, gdd);
+	}
+	if (gdd_prealloc > 0) {
+		INFO_MSG("created %d pooled devices", gdd_prealloc);
+	}
+
+	return 0;
+}
+
+void gdd_quit(void)
+{
+	while (gdd_first) {
+		gdd_destroy(gdd_first);
+	}
+	while (gdd_ready_first) {
+		struct gdd *gdd = gdd_ready_first;
+		LL_RM(gdd_ready_first, gdd_ready_last, gdd);
+		gdd_close(gdd);
+	}
+	if (METRICS_LOAD(metrics_emit.counters[METRICS_EMIT_PACKETS]) > 0) {
+		uint64_t packets = METRICS_LOAD(metrics_emit.counters[METRICS_EMIT_PACKETS]);
+		uint64_t writes = METRICS_LOAD(metrics_emit.counters[METRICS_EMIT_WRITES]);
+		INFO_MSG("uinput: %llu packets, %llu write syscalls, %.2f syscalls per packet (unbatched: %d)",
+		         (unsigned long long)packets, (unsigned long long)writes,
+		         (double)writes / (double)packets, GDD_UNBATCHED_WRITES);
+	}
+	if (METRICS_LOAD(metrics_emit.counters[METRICS_EMIT_FILTERED]) > 0) {
+		INFO_MSG("uinput: %llu axis changes filtered as jitter",
+		         (unsigned long long)METRICS_LOAD(metrics_emit.counters[METRICS_EMIT_FILTERED]));
+	}
+}
+
+struct gdd *gdd_get(uint32_t id)
+{
+	return id < GDD_MAX ? gdd_slots[id] : NULL;
+}
+
+/* pick pooled device for controller: its home, then one never used, then any */
+static struct gdd *gdd_ready_take(uint32_t id)
+{
+	struct gdd *gdd = gdd_home[id];
+
+	if (!gdd || !gdd->pooled || gdd_slots[gdd->id] == gdd) {
+		for (gdd = gdd_ready_first; gdd; gdd = gdd->next) {
+			if (!gdd->homed) {
+				break;
+			}
+		}
+		if (!gdd) {
+			gdd = gdd_ready_first;
+		}
+	}
+	if (gdd) {
+		LL_RM(gdd_ready_first, gdd_ready_last, gdd);
+	}
+
+	return gdd;
+}
+
+struct gdd *gdd_create(uint32_t id, uint8_t type)
+{
+	struct gdd *gdd;
+	char phys[32];
+	int fd;
+
+	ERROR_IF_R(id >= GDD_MAX, NULL, "invalid controller id %u", id);
+	if (gdd_slots[id]) {
+		return gdd_slots[id];
+	}
+
+	/* bind pre-created device, no syscalls */
+	gdd = gdd_ready_take(id);
+	if (gdd) {
+		if (gdd->homed && gdd_home[gdd->id] == gdd && gdd->id != id) {
+			/* stolen from controller that is not around */
+			gdd_home[gdd->id] = NULL;
+		}
+		gdd->id = id;
+		gdd->homed = 1;
+		gdd->keys = keymap_get(id);
+		gdd_home[id] = gdd;
+		LL_APP(gdd_first, gdd_last, gdd);
+		gdd_slots[id] = gdd;
+		return gdd;
+	}
+
+	/* pool empty or not used, create on demand */
+	ERROR_IF_R(!gdd_free, NULL, "device pool exhausted");
+	if (gdd_prealloc > 0) {
+		WARN_MSG("all %d pooled devices in use, creating device for controller %u on demand", gdd_prealloc, id);
+	}
+	snprintf(phys, sizeof(phys), "gamepadd/id%u", id);
+	/* keys of all profiles, so that device can be remapped without recreating it */
+	fd = gdd_open(phys, type, NULL);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	/* take device from pool and fill data */
+	gdd = gdd_free;
+	gdd_free = gdd->next;
+	memset(gdd, 0, sizeof(*gdd));
 	gdd->id = id;
 	gdd->fd = fd;
+	gdd->type = type;
+	gdd->keys = keymap_get(id);
+	gdd->buttons = 0;
+	memset(gdd->axes, GAMEPAD_AXIS_CENTER, sizeof(gdd->axes));
 	LL_APP(gdd_first, gdd_last, gdd);
+	gdd_slots[id] = gdd;
 
 	return gdd;
 }
 
 void gdd_destroy(struct gdd *gdd)
 {
-	if (gdd) {
-		ioctl(gdd->fd, UI_DEV_DESTROY);
-		close(gdd->fd);
-		free(gdd);
+	if (!gdd) {
+		return;
+	}
+	LL_RM(gdd_first, gdd_last, gdd);
+	gdd_slots[gdd->id] = NULL;
+	if (gdd->pooled) {
+		struct timespec ts;
+		/* pooled device stays, nothing may be left pressed for next user */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		gdd_release(gdd, (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+		LL_APP(gdd_ready_first, gdd_ready_last, gdd);
+		return;
 	}
+	gdd_close(gdd);
 }
 
-int gdd_set_buttons(struct gdd *gdd, uint16_t buttons)
+void gdd_set_axis_filter(int deadzone, int hysteresis)
 {
-	struct input_event ie;
-	ie.time.tv_sec = 0;
-	ie.time.tv_usec = 0;
-
-	for (int i = 0; i < 8; i++) {
-		ie.type = EV_KEY;
-		ie.code = 0;
-		ie.value = buttons & (1 << i) ? 1 : 0;
-
-		switch (i) {
-		case 0:
-			ie.code = BTN_A;
-			break;
-		case 1:
-			ie.code = BTN_B;
-			break;
-		case 2:
-			ie.code = BTN_SELECT;
-			break;
-		case 3:
-			ie.code = BTN_START;
-			break;
-		case 4:
-			ie.code = BTN_DPAD_UP;
-			break;
-		case 5:
-			ie.code = BTN_DPAD_DOWN;
-			break;
-		case 6:
-			ie.code = BTN_DPAD_LEFT;
-			break;
-		case 7:
-			ie.code = BTN_DPAD_RIGHT;
-			break;
+	atomic_store_explicit(&gdd_deadzone, deadzone, memory_order_relaxed);
+	atomic_store_explicit(&gdd_hysteresis, hysteresis, memory_order_relaxed);
+}
+
+/* value to report for axis, last reported value if change is only jitter */
+static uint8_t gdd_axis_filter(uint8_t last, uint8_t value)
+{
+	int deadzone = atomic_load_explicit(&gdd_deadzone, memory_order_relaxed);
+	int hysteresis = atomic_load_explicit(&gdd_hysteresis, memory_order_relaxed);
+	int d = (int)value - GAMEPAD_AXIS_CENTER;
+
+	if (d >= -deadzone && d <= deadzone) {
+		return GAMEPAD_AXIS_CENTER;
+	}
+	/* ends of range always go through so full deflection is reached */
+	d = (int)value - (int)last;
+	if (d > -hysteresis && d < hysteresis && value != 0 && value != 255) {
+		return last;
+	}
+
+	return value;
+}
+
+int gdd_set_state(struct gdd *gdd, uint16_t buttons, const uint8_t *axes, uint64_t t_event)
+{
+	unsigned long sec, usec;
+	struct input_event *ie = gdd->frame;
+	uint16_t changed = (gdd->buttons ^ buttons) & ((1 << GDD_BUTTONS) - 1);
+	uint8_t values[GDD_AXES];
+	int axes_changed = 0;
+	ssize_t n;
+
+	metrics_emit_add(METRICS_EMIT_PACKETS, 1);
+
+	if (axes && (gdd->type & GDD_TYPE_AXES)) {
+		for (int i = 0; i < GDD_AXES; i++) {
+			values[i] = gdd_axis_filter(gdd->axes[i], axes[i]);
+			if (values[i] != gdd->axes[i]) {
+				axes_changed |= 1 << i;
+			} else if (axes[i] != gdd->axes[i]) {
+				metrics_emit_add(METRICS_EMIT_FILTERED, 1);
+			}
 		}
+	}
 
-		ERROR_IF(write(gdd->fd, &ie, sizeof(ie)) < 1, "write failed");
+	/* nothing to tell to the kernel if state did not change */
+	if (!changed && !axes_changed) {
+		return 0;
 	}
 
-	ie.type = EV_SYN;
-	ie.code = SYN_REPORT;
-	ie.value = 0;
-	ERROR_IF(write(gdd->fd, &ie, sizeof(ie)) < 1, "write failed");
+	/* all events in frame carry the time state was entered, zero lets kernel stamp them */
+	sec = (unsigned long)(t_event / 1000000000ULL);
+	usec = (unsigned long)((t_event % 1000000000ULL) / 1000);
+
+	/* only keys that changed go into the frame, visit set bits only */
+	while (changed) {
+		int i = __builtin_ctz(changed);
+		changed &= changed - 1;
+		ie->input_event_sec = sec;
+		ie->input_event_usec = usec;
+		ie->type = EV_KEY;
+		ie->code = gdd->keys[i];
+		ie->value = (buttons >> i) & 1;
+		ie++;
+	}
+	while (axes_changed) {
+		int i = __builtin_ctz(axes_changed);
+		axes_changed &= axes_changed - 1;
+		ie->input_event_sec = sec;
+		ie->input_event_usec = usec;
+		ie->type = EV_ABS;
+		ie->code = gdd_axis_codes[i];
+		ie->value = values[i];
+		ie++;
+	}
+	ie->input_event_sec = sec;
+	ie->input_event_usec = usec;
+	ie->type = EV_SYN;
+	ie->code = SYN_REPORT;
+	ie->value = 0;
+	ie++;
+
+	/* whole frame in one write */
+	n = (ssize_t)((uint8_t *)ie - (uint8_t *)gdd->frame);
+	metrics_emit_add(METRICS_EMIT_WRITES, 1);
+	if (write(gdd->fd, gdd->frame, n) != n) {
+		metrics_emit_add(METRICS_EMIT_ERRORS, 1);
+		ERROR_MSG("write failed");
+		return -1;
+	}
+	gdd->buttons = buttons;
+	if (axes && (gdd->type & GDD_TYPE_AXES)) {
+		memcpy(gdd->axes, values, sizeof(gdd->axes));
+	}
 
 	return 0;
 }
 
+int gdd_remap(struct gdd *gdd, const uint16_t *keys, uint64_t t_event)
+{
+	/* held keys are released with codes they were pressed with */
+	if (gdd->buttons && gdd_set_state(gdd, 0, NULL, t_event)) {
+		return -1;
+	}
+	gdd->keys = keys;
+	return 0;
+}
+
+int gdd_release(struct gdd *gdd, uint64_t t_event)
+{
+	static const uint8_t centered[GDD_AXES] = {
+		GAMEPAD_AXIS_CENTER, GAMEPAD_AXIS_CENTER, GAMEPAD_AXIS_CENTER, GAMEPAD_AXIS_CENTER,
+	};
+	return gdd_set_state(gdd, 0, centered, t_event);
+}
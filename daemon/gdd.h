@@ -9,21 +9,97 @@
 #define _GDD_H_
 
 #include <stdint.h>
+#include <linux/input.h>
+
+/* nes buttons and snes extras, see GAMEPAD_BTN_* in gamepad.h */
+#define GDD_BUTTONS     12
+/* analog axes, same as GAMEPAD_AXES */
+#define GDD_AXES        4
+/* controller id is 8 bits, slot table covers all of them */
+#define GDD_MAX         256
+
+/* device capabilities given to gdd_create() */
+#define GDD_TYPE_AXES   0x01
 
 struct gdd {
 	uint32_t id;
 	int fd;
 
+	uint8_t type;
+	/* created at start and returned to pool instead of destroyed */
+	uint8_t pooled;
+	/* pooled device has been bound to a controller at least once */
+	uint8_t homed;
+
+	/* key code of each button bit */
+	const uint16_t *keys;
+	/* last button state written to device */
+	uint16_t buttons;
+	/* last axis values written to device */
+	uint8_t axes[GDD_AXES];
+	/* preallocated event frame: one event per button and axis and syn */
+	struct input_event frame[GDD_BUTTONS + GDD_AXES + 1];
+
 	struct gdd *prev;
 	struct gdd *next;
 };
 
-int gdd_init(void);
+/**
+ * Initialize devices.
+ *
+ * @param  prealloc number of devices to create now, bound to controllers on first contact
+ * @return          0 on success, -1 on errors
+ */
+int gdd_init(int prealloc);
 void gdd_quit(void);
 
+struct gdd *gdd_get(uint32_t id);
+/**
+ * Create device for controller or return existing one.
+ *
+ * @param  id       controller id
+ * @param  type     GDD_TYPE_* capabilities
+ */
 struct gdd *gdd_create(uint32_t id, uint8_t type);
+
+/**
+ * Unbind device from controller. Pooled device is released and kept for
+ * reuse, others are destroyed.
+ */
 void gdd_destroy(struct gdd *gdd);
 
-int gdd_set_buttons(struct gdd *gdd, uint16_t buttons);
+/**
+ * Set axis filtering, applies to all devices.
+ *
+ * @param  deadzone     values this close to center are reported as center
+ * @param  hysteresis   smaller changes from last reported value are ignored
+ */
+void gdd_set_axis_filter(int deadzone, int hysteresis);
+
+/**
+ * Write changed buttons and axes into device.
+ *
+ * @param  gdd      device
+ * @param  buttons  button bits
+ * @param  axes     GDD_AXES axis values, NULL to leave axes as they are
+ * @param  t_event  CLOCK_MONOTONIC time of state in nanoseconds, used as event time,
+ *                  0 leaves event time to kernel
+ */
+int gdd_set_state(struct gdd *gdd, uint16_t buttons, const uint8_t *axes, uint64_t t_event);
+
+/**
+ * Change key codes of device. Buttons held down are released first,
+ * next state presses them again with new codes.
+ *
+ * @param  gdd      device
+ * @param  keys     GDD_BUTTONS key codes, from keymap_get()
+ * @param  t_event  CLOCK_MONOTONIC time in nanoseconds
+ */
+int gdd_remap(struct gdd *gdd, const uint16_t *keys, uint64_t t_event);
+
+/**
+ * Release all buttons and center axes.
+ */
+int gdd_release(struct gdd *gdd, uint64_t t_event);
 
 #endif /* _GDD_H_ */
@@ -0,0 +1,413 @@
+/*
+ * Gamepad trace analyzer
+ *
+ * Computes per controller arrival, loss, duplicate and history recovery
+ * statistics from a trace recorded with gamepadd --record. Trace is
+ * split into chunks analyzed in parallel, each chunk remembers the first
+ * frame of every controller so that chunks can be joined afterwards as
+ * if the whole trace had been walked in order.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libe/log.h>
+#include <libe/os.h>
+#include "cmd.h"
+#include "hist.h"
+#include "dedup.h"
+#include "trace.h"
+#include "../gamepad.h"
+#include "../radio.h"
+
+
+#define GDTRACE_IDS         256
+#define GDTRACE_JOBS_MAX    64
+
+struct ctl {
+	/* first frame of chunk, last frame seen */
+	size_t first;
+	uint64_t t_last;
+	uint8_t seq_last;
+	uint16_t buttons_last;
+
+	uint64_t frames;
+	uint64_t duplicates;
+	uint64_t old;
+	uint64_t resyncs;
+	uint64_t lost;
+	uint64_t bursts;
+	uint64_t burst_max;
+	uint64_t changes;
+	uint64_t recovered;
+	/* time between frames */
+	struct hist arrival;
+	/* how much later than its own frame a state change recovered from history arrived */
+	struct hist delay;
+};
+
+struct job {
+	pthread_t thread;
+	size_t from;
+	size_t to;
+	uint64_t invalid;
+	struct ctl *ctls[GDTRACE_IDS];
+};
+
+static const char *file = NULL;
+static int pipes = RADIO_PIPES;
+static int jobs = 0;
+static int json = 0;
+
+static const struct trace_entry *entries = NULL;
+static size_t entry_count = 0;
+
+static const char opts[] = COMMON_SHORT_OPTS "p:j:J";
+static struct option longopts[] = {
+	COMMON_LONG_OPTS
+	{ "pipes", required_argument, NULL, 'p' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "json", no_argument, NULL, 'J' },
+	{ 0, 0, 0, 0 },
+};
+
+int p_options(int c, char *optarg)
+{
+	switch (c) {
+	case 'p':
+		pipes = atoi(optarg);
+		if (pipes < 1 || pipes > RADIO_PIPES) {
+			ERROR_MSG("invalid number of pipes");
+			return -1;
+		}
+		return 1;
+	case 'j':
+		jobs = atoi(optarg);
+		if (jobs < 1 || jobs > GDTRACE_JOBS_MAX) {
+			ERROR_MSG("number of jobs must be between 1 and %d", GDTRACE_JOBS_MAX);
+			return -1;
+		}
+		return 1;
+	case 'J':
+		json = 1;
+		return 1;
+	}
+	return 0;
+}
+
+void p_help(void)
+{
+	printf(
+	    "  -p, --pipes=COUNT          rx pipes the trace was recorded with, default 6\n"
+	    "  -j, --jobs=COUNT           analyze in this many threads, default one per cpu\n"
+	    "  -J, --json                 print report as json\n"
+	    "\n"
+	    "Usage: gamepad-trace [OPTIONS] FILE\n"
+	    "\n"
+	    "Analyze trace recorded with gamepadd --record.\n"
+	    "\n");
+}
+
+void p_exit(int return_code)
+{
+	log_quit();
+	os_quit();
+	exit(return_code);
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void ctl_start(struct ctl *c, size_t i, const struct gamepad_state *gs)
+{
+	c->first = i;
+	c->t_last = entries[i].t_rx;
+	c->seq_last = gs->seq;
+	c->buttons_last = gs->buttons;
+	c->frames = 1;
+	hist_init(&c->arrival, "arrival");
+	hist_init(&c->delay, "delay");
+}
+
+/*
+ * same classification as daemon does, except that copies of older frames count as old
+ * and restarts are only seen when sequence goes back past window, daemon also notices
+ * them after a quiet period but that depends on frames before the chunk
+ */
+static void ctl_step(struct ctl *c, size_t i, const struct gamepad_state *gs)
+{
+	uint64_t t = entries[i].t_rx;
+	int d = (int8_t)(uint8_t)(gs->seq - c->seq_last);
+
+	c->frames++;
+	/* traces appended over daemon restarts can go back in time */
+	if (t >= c->t_last) {
+		hist_add(&c->arrival, t - c->t_last);
+	}
+	c->t_last = t;
+
+	if (d == 0) {
+		c->duplicates++;
+		return;
+	} else if (d < 0 && -d < DEDUP_WINDOW) {
+		c->old++;
+		return;
+	} else if (d < 0) {
+		/* controller restarted */
+		c->resyncs++;
+		d = 1;
+	}
+
+	if (d > 1) {
+		int missed = d - 1;
+		int n = missed < gs->history_count ? missed : gs->history_count;
+		c->lost += missed;
+		c->bursts++;
+		c->burst_max = (uint64_t)missed > c->burst_max ? (uint64_t)missed : c->burst_max;
+		/* entry age tells how long before this frame its own frame was sent */
+		for (int k = 0; k < n; k++) {
+			hist_add(&c->delay, (uint64_t)gs->history[k].age * 100000ULL);
+		}
+		c->recovered += n;
+	}
+	if (gs->buttons != c->buttons_last) {
+		c->changes++;
+	}
+	c->seq_last = gs->seq;
+	c->buttons_last = gs->buttons;
+}
+
+static int entry_decode(size_t i, struct gamepad_state *gs, int *id)
+{
+	const struct trace_entry *e = &entries[i];
+
+	if (gamepad_decode(e->data, e->len, gs)) {
+		return -1;
+	}
+	*id = pipes > 1 ? transport_frame_id(e->pipe, gs->id, pipes) : gs->id;
+	return *id < 0 ? -1 : 0;
+}
+
+static void *job_run(void *arg)
+{
+	struct job *j = arg;
+
+	for (size_t i = j->from; i < j->to; i++) {
+		struct gamepad_state gs;
+		struct ctl *c;
+		int id;
+
+		if (entry_decode(i, &gs, &id)) {
+			j->invalid++;
+			continue;
+		}
+		c = j->ctls[id];
+		if (!c) {
+			c = j->ctls[id] = malloc(sizeof(*c));
+			if (!c) {
+				continue;
+			}
+			memset(c, 0, sizeof(*c));
+			ctl_start(c, i, &gs);
+			continue;
+		}
+		ctl_step(c, i, &gs);
+	}
+
+	return NULL;
+}
+
+/* continue controller of earlier chunks with same controller from next chunk */
+static void ctl_join(struct ctl *c, struct ctl *next)
+{
+	struct gamepad_state gs;
+	int id;
+
+	entry_decode(next->first, &gs, &id);
+	ctl_step(c, next->first, &gs);
+
+	c->t_last = next->t_last;
+	c->seq_last = next->seq_last;
+	c->buttons_last = next->buttons_last;
+	c->frames += next->frames - 1;
+	c->duplicates += next->duplicates;
+	c->old += next->old;
+	c->resyncs += next->resyncs;
+	c->lost += next->lost;
+	c->bursts += next->bursts;
+	c->burst_max = next->burst_max > c->burst_max ? next->burst_max : c->burst_max;
+	c->changes += next->changes;
+	c->recovered += next->recovered;
+	hist_merge(&c->arrival, &next->arrival);
+	hist_merge(&c->delay, &next->delay);
+}
+
+static double pct(uint64_t part, uint64_t total)
+{
+	return total > 0 ? (double)part * 100.0 / (double)total : 0.0;
+}
+
+/* string with quotes, backslashes and control characters escaped */
+static void print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			printf("\\%c", c);
+		} else if (c < 0x20) {
+			printf("\\u%04x", c);
+		} else {
+			putchar(c);
+		}
+	}
+	putchar('"');
+}
+
+static void print_hist_json(const char *name, struct hist *h)
+{
+	printf("\"%s\":{\"n\":%llu,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}", name,
+	       (unsigned long long)h->count,
+	       (double)hist_percentile(h, 50.0) / 1e3, (double)hist_percentile(h, 99.0) / 1e3,
+	       (double)hist_percentile(h, 99.9) / 1e3, (double)(h->count ? h->max : 0) / 1e3);
+}
+
+static void report(struct ctl **ctls, uint64_t invalid)
+{
+	double span = entry_count > 1 ? (double)(entries[entry_count - 1].t_rx - entries[0].t_rx) / 1e9 : 0.0;
+	int first = 1;
+
+	if (json) {
+		printf("{\"file\":");
+		print_json_string(file);
+		printf(",\"frames\":%zu,\"invalid\":%llu,\"seconds\":%.3f,\"controllers\":[",
+		       entry_count, (unsigned long long)invalid, span);
+	} else {
+		printf("%s: %zu frames over %.3f s, %llu invalid\n", file, entry_count, span, (unsigned long long)invalid);
+		printf("%3s %10s %7s %9s %7s %7s %5s %7s %7s %9s %9s %10s %10s %10s %10s\n",
+		       "id", "frames", "dup%", "lost", "loss%", "bursts", "max", "old", "resyncs", "changes", "recovered",
+		       "arr p50", "arr p99", "arr max", "delay p99");
+	}
+
+	for (int id = 0; id < GDTRACE_IDS; id++) {
+		struct ctl *c = ctls[id];
+		uint64_t accepted;
+		if (!c) {
+			continue;
+		}
+		accepted = c->frames - c->duplicates - c->old;
+		if (json) {
+			printf("%s{\"id\":%d,\"frames\":%llu,\"duplicates\":%llu,\"old\":%llu,\"resyncs\":%llu,\"lost\":%llu,\"loss_pct\":%.3f,"
+			       "\"bursts\":%llu,\"burst_max\":%llu,\"changes\":%llu,\"recovered\":%llu,",
+			       first ? "" : ",", id, (unsigned long long)c->frames, (unsigned long long)c->duplicates,
+			       (unsigned long long)c->old, (unsigned long long)c->resyncs,
+			       (unsigned long long)c->lost, pct(c->lost, accepted + c->lost),
+			       (unsigned long long)c->bursts, (unsigned long long)c->burst_max,
+			       (unsigned long long)c->changes, (unsigned long long)c->recovered);
+			print_hist_json("arrival_us", &c->arrival);
+			printf(",");
+			print_hist_json("delay_us", &c->delay);
+			printf("}");
+		} else {
+			printf("%3d %10llu %7.2f %9llu %7.3f %7llu %5llu %7llu %7llu %9llu %9llu %10.1f %10.1f %10.1f %10.1f\n",
+			       id, (unsigned long long)c->frames, pct(c->duplicates, c->frames),
+			       (unsigned long long)c->lost, pct(c->lost, accepted + c->lost),
+			       (unsigned long long)c->bursts, (unsigned long long)c->burst_max, (unsigned long long)c->old,
+			       (unsigned long long)c->resyncs,
+			       (unsigned long long)c->changes, (unsigned long long)c->recovered,
+			       (double)hist_percentile(&c->arrival, 50.0) / 1e3,
+			       (double)hist_percentile(&c->arrival, 99.0) / 1e3,
+			       (double)(c->arrival.count ? c->arrival.max : 0) / 1e3,
+			       (double)hist_percentile(&c->delay, 99.0) / 1e3);
+		}
+		first = 0;
+	}
+
+	if (json) {
+		printf("]}\n");
+	} else {
+		printf("times in microseconds, delay is how late state changes recovered from history arrived\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static struct job js[GDTRACE_JOBS_MAX];
+	struct ctl *ctls[GDTRACE_IDS];
+	uint64_t t_start, invalid = 0;
+	size_t size = 0;
+
+	os_init();
+	log_init(NULL, 0);
+	if (common_options(argc, argv, opts, longopts)) {
+		ERROR_MSG("invalid command line option(s)");
+		p_exit(EXIT_FAILURE);
+	}
+	if (optind >= argc) {
+		ERROR_MSG("no trace file given");
+		p_exit(EXIT_FAILURE);
+	}
+	file = argv[optind];
+	entries = trace_map(file, &entry_count, &size);
+	if (!entries) {
+		CRIT_MSG("%s is not a trace", file);
+		p_exit(EXIT_FAILURE);
+	}
+
+	if (jobs < 1) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpus < 1 ? 1 : (cpus > GDTRACE_JOBS_MAX ? GDTRACE_JOBS_MAX : (int)cpus);
+	}
+	/* no point in threads for small traces */
+	if ((size_t)jobs > entry_count / 65536 + 1) {
+		jobs = (int)(entry_count / 65536 + 1);
+	}
+
+	t_start = now();
+	for (int i = 0; i < jobs; i++) {
+		js[i].from = entry_count * i / jobs;
+		js[i].to = entry_count * (i + 1) / jobs;
+		if (pthread_create(&js[i].thread, NULL, job_run, &js[i])) {
+			CRIT_MSG("pthread_create() failed");
+			p_exit(EXIT_FAILURE);
+		}
+	}
+
+	/* join chunks in order */
+	memset(ctls, 0, sizeof(ctls));
+	for (int i = 0; i < jobs; i++) {
+		pthread_join(js[i].thread, NULL);
+		invalid += js[i].invalid;
+		for (int id = 0; id < GDTRACE_IDS; id++) {
+			struct ctl *c = js[i].ctls[id];
+			if (!c) {
+				continue;
+			} else if (!ctls[id]) {
+				ctls[id] = c;
+			} else {
+				ctl_join(ctls[id], c);
+				free(c);
+			}
+		}
+	}
+	INFO_MSG("analyzed %zu frames in %.3f s using %d threads", entry_count, (double)(now() - t_start) / 1e9, jobs);
+
+	report(ctls, invalid);
+
+	for (int id = 0; id < GDTRACE_IDS; id++) {
+		free(ctls[id]);
+	}
+	trace_unmap(entries, size);
+	p_exit(EXIT_SUCCESS);
+	return EXIT_SUCCESS;
+}
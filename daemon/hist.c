@@ -0,0 +1,127 @@
+/*
+ * Fixed bucket latency histogram
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <libe/log.h>
+#include "hist.h"
+
+
+#define HIST_LOAD(x)        atomic_load_explicit(&(x), memory_order_relaxed)
+#define HIST_STORE(x, v)    atomic_store_explicit(&(x), (v), memory_order_relaxed)
+
+
+static inline int hist_index(uint64_t v)
+{
+	int e;
+
+	if (v < HIST_SUB) {
+		return (int)v;
+	}
+	e = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+	return e * HIST_SUB + (int)((v >> (e - 1)) - HIST_SUB);
+}
+
+static inline uint64_t hist_value(int i)
+{
+	int e = i / HIST_SUB;
+	uint64_t m = i % HIST_SUB;
+
+	if (e == 0) {
+		return m;
+	}
+	/* middle of the bucket */
+	return ((HIST_SUB + m) << (e - 1)) + ((1ULL << (e - 1)) >> 1);
+}
+
+void hist_init(struct hist *h, const char *name)
+{
+	h->name = name;
+	HIST_STORE(h->count, 0);
+	HIST_STORE(h->sum, 0);
+	HIST_STORE(h->min, UINT64_MAX);
+	HIST_STORE(h->max, 0);
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		HIST_STORE(h->buckets[i], 0);
+	}
+}
+
+void hist_add(struct hist *h, uint64_t v)
+{
+	int i = hist_index(v);
+
+	/* single writer, plain load and store are enough */
+	HIST_STORE(h->buckets[i], HIST_LOAD(h->buckets[i]) + 1);
+	HIST_STORE(h->sum, HIST_LOAD(h->sum) + v);
+	if (v < HIST_LOAD(h->min)) {
+		HIST_STORE(h->min, v);
+	}
+	if (v > HIST_LOAD(h->max)) {
+		HIST_STORE(h->max, v);
+	}
+	HIST_STORE(h->count, HIST_LOAD(h->count) + 1);
+}
+
+void hist_merge(struct hist *dst, struct hist *src)
+{
+	if (HIST_LOAD(src->count) < 1) {
+		return;
+	}
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		HIST_STORE(dst->buckets[i], HIST_LOAD(dst->buckets[i]) + HIST_LOAD(src->buckets[i]));
+	}
+	HIST_STORE(dst->sum, HIST_LOAD(dst->sum) + HIST_LOAD(src->sum));
+	if (HIST_LOAD(src->min) < HIST_LOAD(dst->min)) {
+		HIST_STORE(dst->min, HIST_LOAD(src->min));
+	}
+	if (HIST_LOAD(src->max) > HIST_LOAD(dst->max)) {
+		HIST_STORE(dst->max, HIST_LOAD(src->max));
+	}
+	HIST_STORE(dst->count, HIST_LOAD(dst->count) + HIST_LOAD(src->count));
+}
+
+uint64_t hist_percentile(struct hist *h, double p)
+{
+	uint64_t count = HIST_LOAD(h->count), target, seen = 0;
+
+	if (count < 1) {
+		return 0;
+	}
+	target = (uint64_t)((double)count * p / 100.0);
+	if (target >= count) {
+		target = count - 1;
+	}
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += HIST_LOAD(h->buckets[i]);
+		if (seen > target) {
+			uint64_t v = hist_value(i);
+			/* bucket middle can be outside of seen range */
+			v = v < HIST_LOAD(h->min) ? HIST_LOAD(h->min) : v;
+			v = v > HIST_LOAD(h->max) ? HIST_LOAD(h->max) : v;
+			return v;
+		}
+	}
+
+	return HIST_LOAD(h->max);
+}
+
+void hist_print(struct hist *h)
+{
+	uint64_t count = HIST_LOAD(h->count);
+
+	if (count < 1) {
+		INFO_MSG("%-10s no samples", h->name);
+		return;
+	}
+	INFO_MSG("%-10s n=%llu min=%.1f avg=%.1f p50=%.1f p99=%.1f p99.9=%.1f max=%.1f us",
+	         h->name, (unsigned long long)count,
+	         (double)HIST_LOAD(h->min) / 1e3,
+	         (double)HIST_LOAD(h->sum) / (double)count / 1e3,
+	         (double)hist_percentile(h, 50.0) / 1e3,
+	         (double)hist_percentile(h, 99.0) / 1e3,
+	         (double)hist_percentile(h, 99.9) / 1e3,
+	         (double)HIST_LOAD(h->max) / 1e3);
+}
@@ -0,0 +1,55 @@
+/*
+ * Fixed bucket latency histogram
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Log-linear buckets: each power of two range is split into
+ * HIST_SUB linear buckets, giving about 6 % relative precision
+ * over the whole 64 bit range without any allocation.
+ */
+#define HIST_SUB_BITS       4
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* single writer, readers from any thread see relaxed snapshot */
+struct hist {
+	const char *name;
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t min;
+	_Atomic uint64_t max;
+	_Atomic uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h, const char *name);
+
+/**
+ * Add value into histogram, only one thread may add into same histogram.
+ */
+void hist_add(struct hist *h, uint64_t v);
+
+/**
+ * Add all samples of another histogram, only writer of dst may merge.
+ */
+void hist_merge(struct hist *dst, struct hist *src);
+
+/**
+ * Get value at given percentile (0-100).
+ */
+uint64_t hist_percentile(struct hist *h, double p);
+
+/**
+ * Log one line summary with nanosecond values shown as microseconds.
+ */
+void hist_print(struct hist *h);
+
+#endif /* _HIST_H_ */
@@ -0,0 +1,254 @@
+/*
+ * Gamepad daemon frequency hopping
+ *
+ * Receiver leads the sequence from hop.h, controllers find it by trying
+ * next channels when their frames are not acknowledged.
+ *
+ * Loss is measured per channel in two ways. Frames lost by sequence
+ * number are counted on the channel where the gap was noticed, or split
+ * by time with previous channel if the gap spans a hop, that catches
+ * channels that lose some of the frames. Controllers that were
+ * active but not heard at all during a dwell catch channels that lose
+ * everything, also keepalives that carry no new sequence numbers. Every
+ * few rounds through the sequence the worst channels are blacklisted and
+ * ones that have been blacklisted long enough are given another chance.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <libe/log.h>
+#include "hopper.h"
+#include "gdd.h"
+#include "../hop.h"
+
+
+/* controller heard this recently is expected to be heard on every channel */
+#define HOPPER_ACTIVE_MS        1000
+/* loss in percent that gets a channel blacklisted */
+#define HOPPER_BAD_LOSS         20
+/* fewer samples than this in evaluation period tell nothing */
+#define HOPPER_MIN_SAMPLES      8
+/* never blacklist more, hopping over few channels is still better than none */
+#define HOPPER_MIN_GOOD         4
+
+struct hopper_channel {
+	/* current evaluation period */
+	uint32_t frames;
+	uint32_t lost;
+	uint32_t dwells;
+	uint32_t silent;
+	/* totals for logging */
+	uint64_t total_frames;
+	uint64_t total_lost;
+	uint64_t total_dwells;
+	uint64_t total_silent;
+	uint32_t blacklisted;
+	/* evaluations left on blacklist */
+	uint8_t parole;
+};
+
+static int hopper_on = 0;
+static struct hop hopper_hop;
+static struct hopper_channel hopper_channels[HOP_CHANNELS];
+static uint64_t hopper_dwell_end = 0;
+static uint8_t hopper_prev_pos = 0;
+static int hopper_dwells = 0;
+static uint64_t hopper_hops = 0;
+
+/* per controller, two last times heard and if heard during current dwell */
+static uint64_t hopper_last_seen[GDD_MAX];
+static uint64_t hopper_prev_seen[GDD_MAX];
+static uint8_t hopper_heard[GDD_MAX];
+
+
+int hopper_init(uint32_t seed, uint64_t now)
+{
+	hop_init(&hopper_hop, seed);
+	memset(hopper_channels, 0, sizeof(hopper_channels));
+	memset(hopper_last_seen, 0, sizeof(hopper_last_seen));
+	memset(hopper_prev_seen, 0, sizeof(hopper_prev_seen));
+	memset(hopper_heard, 0, sizeof(hopper_heard));
+	hopper_dwell_end = now + HOP_DWELL_MS * 1000000ULL;
+	hopper_dwells = 0;
+	hopper_hops = 0;
+	hopper_prev_pos = hopper_hop.pos;
+	hopper_on = 1;
+
+	INFO_MSG("hopping over %d channels, %d ms on each, seed 0x%08x", HOP_CHANNELS, HOP_DWELL_MS, seed);
+	return hop_channel(&hopper_hop);
+}
+
+int hopper_enabled(void)
+{
+	return hopper_on;
+}
+
+void hopper_seen(uint8_t id, uint64_t now)
+{
+	if (!hopper_on) {
+		return;
+	}
+	hopper_prev_seen[id] = hopper_last_seen[id];
+	hopper_last_seen[id] = now;
+	hopper_heard[id] = 1;
+}
+
+static void hopper_add(uint8_t pos, int frames, int lost)
+{
+	struct hopper_channel *c = &hopper_channels[pos];
+
+	c->frames += (uint32_t)frames;
+	c->lost += (uint32_t)lost;
+	c->total_frames += (uint64_t)frames;
+	c->total_lost += (uint64_t)lost;
+}
+
+void hopper_count(uint8_t id, int missed)
+{
+	uint64_t dwell_start, prev, now;
+
+	if (!hopper_on) {
+		return;
+	}
+	dwell_start = hopper_dwell_end - HOP_DWELL_MS * 1000000ULL;
+	prev = hopper_prev_seen[id];
+	now = hopper_last_seen[id];
+
+	/* frames were sent evenly over the silence, part of it was on previous channel */
+	if (missed > 0 && prev && prev < dwell_start && now > dwell_start) {
+		int before = (int)((uint64_t)missed * (dwell_start - prev) / (now - prev));
+		hopper_add(hopper_prev_pos, before, before);
+		missed -= before;
+	}
+	hopper_add(hopper_hop.pos, 1 + missed, missed);
+}
+
+/* percent lost, by frames or by silent dwells whichever is worse, -1 if not enough samples */
+static int hopper_loss(struct hopper_channel *c)
+{
+	int loss = -1;
+
+	if (c->frames >= HOPPER_MIN_SAMPLES) {
+		loss = (int)(c->lost * 100 / c->frames);
+	}
+	if (c->dwells >= HOPPER_MIN_SAMPLES && (int)(c->silent * 100 / c->dwells) > loss) {
+		loss = (int)(c->silent * 100 / c->dwells);
+	}
+	return loss;
+}
+
+static void hopper_evaluate(void)
+{
+	int good = 0, loss[HOP_CHANNELS];
+
+	for (int i = 0; i < HOP_CHANNELS; i++) {
+		struct hopper_channel *c = &hopper_channels[i];
+		loss[i] = hopper_loss(c);
+		/* blacklisted long enough, measure it again */
+		if (c->parole > 0 && --c->parole == 0) {
+			hopper_hop.blacklist &= ~(1u << i);
+			INFO_MSG("channel %d back in use", hopper_hop.seq[i]);
+		}
+		if (!(hopper_hop.blacklist & (1u << i))) {
+			good++;
+		}
+	}
+
+	/* worst first, as long as enough channels are left */
+	while (good > HOPPER_MIN_GOOD) {
+		int worst = -1;
+		for (int i = 0; i < HOP_CHANNELS; i++) {
+			if (hopper_hop.blacklist & (1u << i) || loss[i] < HOPPER_BAD_LOSS) {
+				continue;
+			}
+			if (worst < 0 || loss[i] > loss[worst]) {
+				worst = i;
+			}
+		}
+		if (worst < 0) {
+			break;
+		}
+		hopper_hop.blacklist |= 1u << worst;
+		hopper_channels[worst].parole = HOPPER_PAROLE;
+		hopper_channels[worst].blacklisted++;
+		good--;
+		INFO_MSG("channel %d blacklisted, %d%% lost", hopper_hop.seq[worst], loss[worst]);
+	}
+
+	for (int i = 0; i < HOP_CHANNELS; i++) {
+		struct hopper_channel *c = &hopper_channels[i];
+		c->frames = c->lost = c->dwells = c->silent = 0;
+	}
+}
+
+int hopper_run(uint64_t now)
+{
+	struct hopper_channel *c;
+	uint64_t active_ns = HOPPER_ACTIVE_MS * 1000000ULL;
+
+	if (!hopper_on || now < hopper_dwell_end) {
+		return -1;
+	}
+
+	/* who should have been heard during dwell that ended */
+	c = &hopper_channels[hopper_hop.pos];
+	for (int id = 0; id < GDD_MAX; id++) {
+		if (hopper_last_seen[id] && now - hopper_last_seen[id] < active_ns) {
+			c->dwells++;
+			c->total_dwells++;
+			if (!hopper_heard[id]) {
+				c->silent++;
+				c->total_silent++;
+			}
+		}
+		hopper_heard[id] = 0;
+	}
+
+	if (++hopper_dwells >= HOPPER_EVAL_DWELLS) {
+		hopper_evaluate();
+		hopper_dwells = 0;
+	}
+
+	/* late wakeup does not shift the schedule controllers are following */
+	hopper_dwell_end += HOP_DWELL_MS * 1000000ULL;
+	if (hopper_dwell_end <= now) {
+		hopper_dwell_end = now + HOP_DWELL_MS * 1000000ULL;
+	}
+	hopper_hops++;
+	hopper_prev_pos = hopper_hop.pos;
+
+	return hop_next(&hopper_hop);
+}
+
+int hopper_beacon(uint8_t *buf)
+{
+	if (!hopper_on) {
+		return 0;
+	}
+	return hop_beacon(&hopper_hop, buf);
+}
+
+int hopper_timeout_ms(uint64_t now)
+{
+	if (!hopper_on) {
+		return -1;
+	}
+	return now < hopper_dwell_end ? (int)((hopper_dwell_end - now + 999999) / 1000000) : 0;
+}
+
+void hopper_print(void)
+{
+	if (!hopper_on) {
+		return;
+	}
+	INFO_MSG("hopping: %llu hops, on channel %d", (unsigned long long)hopper_hops, hop_channel(&hopper_hop));
+	for (int i = 0; i < HOP_CHANNELS; i++) {
+		struct hopper_channel *c = &hopper_channels[i];
+		INFO_MSG("  channel %3d: %llu frames %llu lost, %llu/%llu dwells silent, blacklisted %u times%s",
+		         hopper_hop.seq[i], (unsigned long long)c->total_frames, (unsigned long long)c->total_lost,
+		         (unsigned long long)c->total_silent, (unsigned long long)c->total_dwells,
+		         c->blacklisted, hopper_hop.blacklist & (1u << i) ? ", now blacklisted" : "");
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Gamepad daemon frequency hopping
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _HOPPER_H_
+#define _HOPPER_H_
+
+#include <stdint.h>
+#include "../hop.h"
+
+/* blacklist is updated after this many dwells */
+#define HOPPER_EVAL_DWELLS      (HOP_CHANNELS * 2)
+/* evaluations before blacklisted channel is tried again */
+#define HOPPER_PAROLE           8
+
+/**
+ * Start hopping.
+ * Only receiver thread may call hopper functions.
+ *
+ * @param  seed     sequence seed, controllers must be built with same
+ * @param  now      current time in nanoseconds
+ * @return          first channel
+ */
+int hopper_init(uint32_t seed, uint64_t now);
+
+/**
+ * Check if hopping is in use.
+ */
+int hopper_enabled(void);
+
+/**
+ * Mark controller as heard on current channel, any frame counts including duplicates.
+ */
+void hopper_seen(uint8_t id, uint64_t now);
+
+/**
+ * Count accepted frame and frames lost before it, call after hopper_seen().
+ */
+void hopper_count(uint8_t id, int missed);
+
+/**
+ * Move to next channel when dwell time is over.
+ *
+ * @return          channel radio must be moved to, -1 if it stays
+ */
+int hopper_run(uint64_t now);
+
+/**
+ * Acknowledgement payload telling controllers where receiver is.
+ *
+ * @param  buf      buffer of HOP_BEACON_SIZE bytes
+ * @return          payload length, 0 if not hopping
+ */
+int hopper_beacon(uint8_t *buf);
+
+/**
+ * Milliseconds until next hop, for wait timeouts.
+ */
+int hopper_timeout_ms(uint64_t now);
+
+/**
+ * Log per channel loss and blacklist.
+ */
+void hopper_print(void);
+
+#endif /* _HOPPER_H_ */
@@ -0,0 +1,177 @@
+/*
+ * Gamepad daemon radio interrupt source
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/gpio.h>
+#include <libe/log.h>
+#include "irq.h"
+
+
+#define IRQ_TYPE_NONE       0
+#define IRQ_TYPE_GPIO       1
+#define IRQ_TYPE_FAKE       2
+#define IRQ_TYPE_FD         3
+
+static int irq_type = IRQ_TYPE_NONE;
+static int irq_epoll_fd = -1;
+static int irq_event_fd = -1;
+
+
+static int irq_epoll_add(int fd)
+{
+	struct epoll_event ev;
+
+	irq_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ERROR_IF_R(irq_epoll_fd < 0, -1, "epoll_create1() failed: %s", strerror(errno));
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	ERROR_IF_R(epoll_ctl(irq_epoll_fd, EPOLL_CTL_ADD, fd, &ev), -1, "epoll_ctl() failed: %s", strerror(errno));
+
+	irq_event_fd = fd;
+	return 0;
+}
+
+int irq_open_gpio(const char *chip, unsigned int line)
+{
+	struct gpioevent_request req;
+	int fd;
+
+	fd = open(chip, O_RDONLY | O_CLOEXEC);
+	ERROR_IF_R(fd < 0, -1, "unable to open gpio chip %s: %s", chip, strerror(errno));
+
+	/* nrf irq is active low */
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = line;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	strncpy(req.consumer_label, "gamepadd", sizeof(req.consumer_label) - 1);
+	if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+		ERROR_MSG("unable to request line event for %s line %u: %s", chip, line, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if (irq_epoll_add(req.fd)) {
+		close(req.fd);
+		irq_close();
+		return -1;
+	}
+	irq_type = IRQ_TYPE_GPIO;
+
+	return 0;
+}
+
+int irq_open_fake(double hz)
+{
+	struct itimerspec its;
+	long ns;
+	int fd;
+
+	ERROR_IF_R(hz <= 0.0, -1, "invalid fake interrupt rate");
+	ns = (long)(1e9 / hz);
+	if (ns < 1) {
+		ns = 1;
+	}
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	ERROR_IF_R(fd < 0, -1, "timerfd_create() failed: %s", strerror(errno));
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = ns / 1000000000L;
+	its.it_interval.tv_nsec = ns % 1000000000L;
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	if (irq_epoll_add(fd)) {
+		close(fd);
+		irq_close();
+		return -1;
+	}
+	irq_type = IRQ_TYPE_FAKE;
+
+	return 0;
+}
+
+int irq_open_fd(int fd)
+{
+	if (irq_epoll_add(fd)) {
+		irq_close();
+		return -1;
+	}
+	irq_type = IRQ_TYPE_FD;
+
+	return 0;
+}
+
+void irq_close(void)
+{
+	/* descriptor given by caller is not ours to close */
+	if (irq_type == IRQ_TYPE_FD) {
+		irq_event_fd = -1;
+	}
+	if (irq_event_fd >= 0) {
+		close(irq_event_fd);
+		irq_event_fd = -1;
+	}
+	if (irq_epoll_fd >= 0) {
+		close(irq_epoll_fd);
+		irq_epoll_fd = -1;
+	}
+	irq_type = IRQ_TYPE_NONE;
+}
+
+int irq_is_open(void)
+{
+	return irq_type != IRQ_TYPE_NONE;
+}
+
+int irq_wait(int timeout_ms, uint64_t *t)
+{
+	struct epoll_event ev;
+	int n;
+
+	n = epoll_wait(irq_epoll_fd, &ev, 1, timeout_ms);
+	if (n < 0) {
+		/* signals are not errors, just return as timeout */
+		return errno == EINTR ? 0 : -1;
+	} else if (n == 0) {
+		return 0;
+	}
+
+	*t = irq_now();
+
+	if (irq_type == IRQ_TYPE_GPIO) {
+		struct gpioevent_data ge;
+		/* read one edge and use its kernel timestamp as interrupt time */
+		if (read(irq_event_fd, &ge, sizeof(ge)) == sizeof(ge) && ge.timestamp > 0 && ge.timestamp <= *t) {
+			*t = ge.timestamp;
+		}
+	} else if (irq_type == IRQ_TYPE_FAKE) {
+		uint64_t expirations;
+		if (read(irq_event_fd, &expirations, sizeof(expirations)) < 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+uint64_t irq_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,65 @@
+/*
+ * Gamepad daemon radio interrupt source
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _IRQ_H_
+#define _IRQ_H_
+
+#include <stdint.h>
+
+/**
+ * Open nRF24L01+ IRQ line as GPIO character device line event.
+ *
+ * @param  chip     gpio chip device, for example "/dev/gpiochip0"
+ * @param  line     line offset in chip
+ * @return          0 on success, -1 on errors
+ */
+int irq_open_gpio(const char *chip, unsigned int line);
+
+/**
+ * Open fake interrupt source that fires at given rate.
+ * Used for testing the event driven loop without real radio.
+ *
+ * @param  hz       interrupt rate
+ * @return          0 on success, -1 on errors
+ */
+int irq_open_fake(double hz);
+
+/**
+ * Use readability of a file descriptor as interrupt source.
+ * Descriptor is only waited on, reading and closing it is left to the caller.
+ *
+ * @param  fd       file descriptor, for example from transport
+ * @return          0 on success, -1 on errors
+ */
+int irq_open_fd(int fd);
+
+/**
+ * Close interrupt source.
+ */
+void irq_close(void);
+
+/**
+ * Check if interrupt source is open.
+ */
+int irq_is_open(void);
+
+/**
+ * Wait for interrupt.
+ *
+ * @param  timeout_ms   maximum time to wait, -1 to wait forever
+ * @param  t            time of interrupt in nanoseconds (CLOCK_MONOTONIC),
+ *                      event timestamp from kernel when available
+ * @return              1 if woken by interrupt, 0 on timeout, -1 on errors
+ */
+int irq_wait(int timeout_ms, uint64_t *t);
+
+/**
+ * Get current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t irq_now(void);
+
+#endif /* _IRQ_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Gamepad daemon button to key code mapping
+ *
+ * Profiles are defined once in KEYMAPS() and expanded here into the
+ * name list and a code table indexed by button bit, so both the keys
+ * enabled on device creation and the keys written on state changes
+ * come from the same row.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <libe/log.h>
+#include "keymap.h"
+
+
+#define KEYMAP_NAME(name, ...)  #name,
+static const char *keymap_names[KEYMAP_COUNT] = {
+	KEYMAPS(KEYMAP_NAME)
+};
+#undef KEYMAP_NAME
+
+#define KEYMAP_ROW(name, ...)   { __VA_ARGS__ },
+static const uint16_t keymap_codes_table[KEYMAP_COUNT][GDD_BUTTONS] = {
+	KEYMAPS(KEYMAP_ROW)
+};
+#undef KEYMAP_ROW
+
+/* every row must have a code for each button */
+#define KEYMAP_CHECK(name, ...) \
+	_Static_assert(sizeof((uint16_t[]){ __VA_ARGS__ }) == GDD_BUTTONS * sizeof(uint16_t), "keymap " #name " has wrong number of buttons");
+KEYMAPS(KEYMAP_CHECK)
+#undef KEYMAP_CHECK
+
+/* selections from command line, base of every table loaded later */
+static struct keymap_table keymap_base = { .def = KEYMAP_nes };
+/* table readers use, replaced as a whole on reload */
+static _Atomic(struct keymap_table *) keymap_current = &keymap_base;
+/* replaced tables, freed when publish sees no reader inside keymap_get() */
+static struct keymap_table *keymap_retired = NULL;
+static atomic_int keymap_readers = 0;
+
+
+int keymap_find(const char *name)
+{
+	for (int i = 0; i < KEYMAP_COUNT; i++) {
+		if (strcmp(name, keymap_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *keymap_name(int keymap)
+{
+	return keymap >= 0 && keymap < KEYMAP_COUNT ? keymap_names[keymap] : "unknown";
+}
+
+static int keymap_table_set(struct keymap_table *table, int id, int keymap)
+{
+	ERROR_IF_R(keymap < 0 || keymap >= KEYMAP_COUNT, -1, "invalid keymap");
+	if (id < 0) {
+		table->def = keymap;
+		return 0;
+	}
+	ERROR_IF_R(id >= GDD_MAX, -1, "invalid controller id %d", id);
+	table->of[id] = keymap + 1;
+	return 0;
+}
+
+static int keymap_table_parse(struct keymap_table *table, const char *spec)
+{
+	const char *name = spec;
+	char *end;
+	int id = -1, keymap;
+
+	if (strchr(spec, '=')) {
+		id = (int)strtol(spec, &end, 0);
+		ERROR_IF_R(end == spec || *end != '=', -1, "invalid controller id in keymap %s", spec);
+		name = end + 1;
+	}
+	keymap = keymap_find(name);
+	ERROR_IF_R(keymap < 0, -1, "unknown keymap %s", name);
+
+	return keymap_table_set(table, id, keymap);
+}
+
+int keymap_set(int id, int keymap)
+{
+	return keymap_table_set(&keymap_base, id, keymap);
+}
+
+int keymap_parse(const char *spec)
+{
+	return keymap_table_parse(&keymap_base, spec);
+}
+
+struct keymap_table *keymap_new(void)
+{
+	struct keymap_table *table = malloc(sizeof(*table));
+	ERROR_IF_R(!table, NULL, "out of memory");
+	memcpy(table, &keymap_base, sizeof(*table));
+	return table;
+}
+
+int keymap_edit(struct keymap_table *table, const char *spec)
+{
+	return keymap_table_parse(table, spec);
+}
+
+void keymap_publish(struct keymap_table *table)
+{
+	struct keymap_table *old = atomic_exchange(&keymap_current, table);
+
+	if (old != &keymap_base) {
+		old->retired = keymap_retired;
+		keymap_retired = old;
+	}
+	/*
+	 * Reader that is not inside now loads the new table when it comes
+	 * in, so nothing replaced so far can be in use any more. Otherwise
+	 * wait for next publish, reloads are rare and tables small.
+	 */
+	if (atomic_load(&keymap_readers) == 0) {
+		while (keymap_retired) {
+			struct keymap_table *next = keymap_retired->retired;
+			free(keymap_retired);
+			keymap_retired = next;
+		}
+	}
+}
+
+const uint16_t *keymap_get(uint32_t id)
+{
+	const struct keymap_table *table;
+	const uint16_t *codes;
+
+	atomic_fetch_add(&keymap_readers, 1);
+	table = atomic_load(&keymap_current);
+	if (id < GDD_MAX && table->of[id]) {
+		codes = keymap_codes_table[table->of[id] - 1];
+	} else {
+		codes = keymap_codes_table[table->def];
+	}
+	atomic_fetch_sub_explicit(&keymap_readers, 1, memory_order_release);
+
+	return codes;
+}
+
+const uint16_t *keymap_codes(int keymap)
+{
+	return keymap_codes_table[keymap];
+}
+
+void keymap_help(void)
+{
+	printf("Keymaps:\n");
+	for (int i = 0; i < KEYMAP_COUNT; i++) {
+		if (i == keymap_base.def) {
+			printf("  %-26s default\n", keymap_names[i]);
+		} else {
+			printf("  %s\n", keymap_names[i]);
+		}
+	}
+	printf("\n");
+}
@@ -0,0 +1,111 @@
+/*
+ * Gamepad daemon button to key code mapping
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _KEYMAP_H_
+#define _KEYMAP_H_
+
+#include <stdint.h>
+#include <linux/input.h>
+#include "gdd.h"
+
+/*
+ * All mapping profiles, one row each. Columns follow GAMEPAD_BTN_* bit
+ * order in gamepad.h: A, B, select, start, up, down, left, right, X, Y, L, R.
+ *
+ *  nes:  by label, A is BTN_A and so on
+ *  snes: by position, SNES A is on the east side of the diamond
+ *  xbox: by position using xbox labels, SNES B is xbox A
+ */
+#define KEYMAPS(X) \
+	X(nes,  BTN_A,    BTN_B,     BTN_SELECT, BTN_START, BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_X,     BTN_Y,    BTN_TL, BTN_TR) \
+	X(snes, BTN_EAST, BTN_SOUTH, BTN_SELECT, BTN_START, BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_NORTH, BTN_WEST, BTN_TL, BTN_TR) \
+	X(xbox, BTN_B,    BTN_A,     BTN_SELECT, BTN_START, BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_Y,     BTN_X,    BTN_TL, BTN_TR)
+
+#define KEYMAP_ENUM(name, ...)  KEYMAP_##name,
+enum {
+	KEYMAPS(KEYMAP_ENUM)
+	KEYMAP_COUNT
+};
+#undef KEYMAP_ENUM
+
+/* profile of each controller, published whole and never modified after */
+struct keymap_table {
+	int def;
+	/* profile plus one, zero means default */
+	uint8_t of[GDD_MAX];
+	/* next replaced table waiting to be freed */
+	struct keymap_table *retired;
+};
+
+/**
+ * Find profile by name.
+ *
+ * @return          profile index, -1 if not found
+ */
+int keymap_find(const char *name);
+
+/**
+ * Get profile name.
+ */
+const char *keymap_name(int keymap);
+
+/**
+ * Select profile for given controller on command line, before threads are started.
+ *
+ * @param  id       controller id, -1 to set default for all controllers
+ * @param  keymap   profile index
+ * @return          0 on success, -1 on errors
+ */
+int keymap_set(int id, int keymap);
+
+/**
+ * Parse and apply "[ID=]NAME" selection.
+ *
+ * @return          0 on success, -1 on errors
+ */
+int keymap_parse(const char *spec);
+
+/**
+ * Start new table from command line selections.
+ *
+ * @return          table to be modified with keymap_edit(), NULL on errors
+ */
+struct keymap_table *keymap_new(void);
+
+/**
+ * Apply "[ID=]NAME" selection into table that is not yet published.
+ *
+ * @return          0 on success, -1 on errors
+ */
+int keymap_edit(struct keymap_table *table, const char *spec);
+
+/**
+ * Replace table used by readers, takes ownership of given table.
+ * Replaced table is freed once no reader is inside keymap_get().
+ * Must not be called from more than one thread.
+ */
+void keymap_publish(struct keymap_table *table);
+
+/**
+ * Get key codes for controller, indexed by button bit. Safe from any
+ * thread, codes are static and stay valid.
+ *
+ * @return          table of GDD_BUTTONS key codes
+ */
+const uint16_t *keymap_get(uint32_t id);
+
+/**
+ * Get key codes of given profile, indexed by button bit.
+ */
+const uint16_t *keymap_codes(int keymap);
+
+/**
+ * Print profile names.
+ */
+void keymap_help(void);
+
+#endif /* _KEYMAP_H_ */
@@ -0,0 +1,185 @@
+/*
+ * Gamepad network controller load generator
+ *
+ * Simulates a number of network controllers sending frames at fixed
+ * rate to gamepadd udp transport.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <libe/log.h>
+#include <libe/os.h>
+#include "cmd.h"
+#include "../gamepad.h"
+
+
+#define LOADGEN_MAX         256
+#define LOADGEN_BATCH       64
+
+static int controllers = 100;
+static double rate = 1000.0;
+static double duration = 10.0;
+static const char *host = "127.0.0.1";
+static int port = 7777;
+
+static struct gamepad_state states[LOADGEN_MAX];
+static uint8_t frames[LOADGEN_MAX][GAMEPAD_FRAME_MAX];
+static struct mmsghdr msgs[LOADGEN_MAX];
+static struct iovec iovs[LOADGEN_MAX];
+
+static const char opts[] = COMMON_SHORT_OPTS "n:r:d:a:p:";
+static struct option longopts[] = {
+	COMMON_LONG_OPTS
+	{ "controllers", required_argument, NULL, 'n' },
+	{ "rate", required_argument, NULL, 'r' },
+	{ "duration", required_argument, NULL, 'd' },
+	{ "address", required_argument, NULL, 'a' },
+	{ "port", required_argument, NULL, 'p' },
+	{ 0, 0, 0, 0 },
+};
+
+int p_options(int c, char *optarg)
+{
+	switch (c) {
+	case 'n':
+		controllers = atoi(optarg);
+		if (controllers < 1 || controllers > LOADGEN_MAX) {
+			ERROR_MSG("controller count must be between 1 and %d", LOADGEN_MAX);
+			return -1;
+		}
+		return 1;
+	case 'r':
+		rate = atof(optarg);
+		if (rate <= 0.0) {
+			ERROR_MSG("invalid rate");
+			return -1;
+		}
+		return 1;
+	case 'd':
+		duration = atof(optarg);
+		return 1;
+	case 'a':
+		host = strdup(optarg);
+		return 1;
+	case 'p':
+		port = atoi(optarg);
+		return 1;
+	}
+	return 0;
+}
+
+void p_help(void)
+{
+	printf(
+	    "  -n, --controllers=COUNT    number of simulated controllers, default 100\n"
+	    "  -r, --rate=HZ              frames per second per controller, default 1000\n"
+	    "  -d, --duration=SECONDS     how long to run, default 10\n"
+	    "  -a, --address=IP           gamepadd address, default 127.0.0.1\n"
+	    "  -p, --port=PORT            gamepadd udp port, default 7777\n"
+	    "\n"
+	    "Load generator for gamepadd udp transport.\n"
+	    "\n");
+}
+
+void p_exit(int return_code)
+{
+	log_quit();
+	os_quit();
+	exit(return_code);
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	struct timespec next;
+	uint64_t t_start, t_end, interval, sent = 0, ticks = 0;
+	int fd;
+
+	os_init();
+	log_init(NULL, 0);
+	if (common_options(argc, argv, opts, longopts)) {
+		ERROR_MSG("invalid command line option(s)");
+		p_exit(EXIT_FAILURE);
+	}
+	if (common_rt_init()) {
+		p_exit(EXIT_FAILURE);
+	}
+	common_rt_check("loadgen", pthread_self(), -1);
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		CRIT_MSG("socket() failed: %s", strerror(errno));
+		p_exit(EXIT_FAILURE);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+		CRIT_MSG("invalid address: %s", host);
+		p_exit(EXIT_FAILURE);
+	}
+
+	/* one prebuilt packet and message per controller */
+	memset(states, 0, sizeof(states));
+	memset(msgs, 0, sizeof(msgs));
+	for (int i = 0; i < controllers; i++) {
+		states[i].id = (uint8_t)i;
+		iovs[i].iov_base = frames[i];
+		msgs[i].msg_hdr.msg_name = &addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	INFO_MSG("%d controllers at %g Hz to %s:%d for %g s", controllers, rate, host, port, duration);
+	interval = (uint64_t)(1e9 / rate);
+	t_start = now();
+	t_end = t_start + (uint64_t)(duration * 1e9);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (now() < t_end) {
+		/* every controller changes state on every tick */
+		for (int i = 0; i < controllers; i++) {
+			states[i].seq++;
+			states[i].buttons = (uint16_t)(1 << ((ticks + i) % GAMEPAD_BUTTONS));
+			iovs[i].iov_len = gamepad_encode(&states[i], frames[i]);
+		}
+		for (int i = 0; i < controllers; i += LOADGEN_BATCH) {
+			int n = controllers - i < LOADGEN_BATCH ? controllers - i : LOADGEN_BATCH;
+			int ok = sendmmsg(fd, &msgs[i], n, 0);
+			if (ok > 0) {
+				sent += ok;
+			}
+		}
+		ticks++;
+
+		/* absolute sleep keeps rate even if sending takes time */
+		next.tv_nsec += interval;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	INFO_MSG("sent %llu frames in %.2f s, %.0f frames per second",
+	         (unsigned long long)sent, (double)(now() - t_start) / 1e9,
+	         (double)sent * 1e9 / (double)(now() - t_start));
+
+	p_exit(EXIT_SUCCESS);
+	return EXIT_SUCCESS;
+}
@@ -5,27 +5,293 @@
  *  Antti Partanen <aehparta@iki.fi>
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include <libe/log.h>
 #include <libe/os.h>
-#include <libe/drivers/spi/nrf.h>
 #include "gdd.h"
+#include "irq.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "dedup.h"
+#include "transport.h"
+#include "keymap.h"
+#include "reap.h"
+#include "trace.h"
+#include "probe.h"
+#include "metrics.h"
+#include "conf.h"
+#include "hopper.h"
 #include "cmd.h"
 #include "../config.h"
 #include "../gamepad.h"
+#include "../radio.h"
 
 
-struct spi_master master;
-struct nrf_device nrf;
+/* where frames come from */
+static const char *transport_spec = "nrf";
+static struct transport_opts transport_opts = {
+	.pipes = RADIO_PIPES,
+	.channel = RADIO_CHANNEL,
+	.data_rate = RADIO_DATA_RATE,
+	.rate = 0.0,
+	.speed = 1.0,
+};
+static struct transport *transport = NULL;
+
+/* received frames are recorded into this file */
+static const char *record_file = NULL;
+
+/* settings that can be reloaded, file overrides command line */
+static const char *config_file = NULL;
+static int channel = RADIO_CHANNEL;
+static int data_rate = RADIO_DATA_RATE;
+static volatile sig_atomic_t reload_requested = 0;
+
+/* frequency hopping sequence seed, 0 for fixed channel */
+static uint32_t hop_seed = 0;
+
+/* counters are served on this unix socket */
+static const char *metrics_socket = NULL;
+
+/* loopback latency probe */
+static int probe_count = 0;
+static double probe_rate = 250.0;
+static int probe_load = 0;
+
+/* interrupt source, polling is used if none given */
+static const char *irq_chip = "/dev/gpiochip0";
+static int irq_line = -1;
+static double irq_fake_hz = 0.0;
+
+/* separate receiver and emitter threads */
+static int pipeline = 0;
+static int rx_cpu = -1;
+static int emit_cpu = -1;
+
+/* pre-created devices, -1 for one per pipe */
+static int pool_size = -1;
 
-static const char opts[] = COMMON_SHORT_OPTS;
+/* silent controllers, timeouts in milliseconds */
+static int release_timeout = 500;
+static int idle_timeout = 60000;
+
+/* analog axis filtering */
+static int axis_deadzone = 8;
+static int axis_hysteresis = 2;
+
+/* long only options */
+enum {
+	OPT_RX_CPU = 0x100,
+	OPT_POOL,
+	OPT_EMIT_CPU,
+	OPT_DEADZONE,
+	OPT_HYSTERESIS,
+	OPT_RELEASE_TIMEOUT,
+	OPT_IDLE_TIMEOUT,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_SPEED,
+	OPT_PROBE,
+	OPT_PROBE_RATE,
+	OPT_PROBE_LOAD,
+	OPT_METRICS,
+	OPT_CONFIG,
+	OPT_CHANNEL,
+	OPT_DATA_RATE,
+	OPT_HOP,
+};
+
+/* dump statistics on SIGUSR1 */
+static int stats_on_signal = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+static const char opts[] = COMMON_SHORT_OPTS "t:r:i:C:F:p:Tsm:";
 static struct option longopts[] = {
 	COMMON_LONG_OPTS
+	{ "transport", required_argument, NULL, 't' },
+	{ "rate", required_argument, NULL, 'r' },
+	{ "irq", required_argument, NULL, 'i' },
+	{ "irq-chip", required_argument, NULL, 'C' },
+	{ "irq-fake", required_argument, NULL, 'F' },
+	{ "pipes", required_argument, NULL, 'p' },
+	{ "pipeline", no_argument, NULL, 'T' },
+	{ "stats", no_argument, NULL, 's' },
+	{ "keymap", required_argument, NULL, 'm' },
+	{ "pool", required_argument, NULL, OPT_POOL },
+	{ "rx-cpu", required_argument, NULL, OPT_RX_CPU },
+	{ "emit-cpu", required_argument, NULL, OPT_EMIT_CPU },
+	{ "deadzone", required_argument, NULL, OPT_DEADZONE },
+	{ "hysteresis", required_argument, NULL, OPT_HYSTERESIS },
+	{ "release-timeout", required_argument, NULL, OPT_RELEASE_TIMEOUT },
+	{ "idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT },
+	{ "record", required_argument, NULL, OPT_RECORD },
+	{ "replay", required_argument, NULL, OPT_REPLAY },
+	{ "speed", required_argument, NULL, OPT_SPEED },
+	{ "probe", required_argument, NULL, OPT_PROBE },
+	{ "probe-rate", required_argument, NULL, OPT_PROBE_RATE },
+	{ "probe-load", required_argument, NULL, OPT_PROBE_LOAD },
+	{ "metrics", required_argument, NULL, OPT_METRICS },
+	{ "config", required_argument, NULL, OPT_CONFIG },
+	{ "channel", required_argument, NULL, OPT_CHANNEL },
+	{ "data-rate", required_argument, NULL, OPT_DATA_RATE },
+	{ "hop", required_argument, NULL, OPT_HOP },
 	{ 0, 0, 0, 0 },
 };
 
 int p_options(int c, char *optarg)
 {
 	switch (c) {
+	case 't':
+		transport_spec = strdup(optarg);
+		return 1;
+	case 'r':
+		transport_opts.rate = atof(optarg);
+		if (transport_opts.rate < 0.0) {
+			ERROR_MSG("invalid rate");
+			return -1;
+		}
+		return 1;
+	case 'i':
+		irq_line = atoi(optarg);
+		if (irq_line < 0) {
+			ERROR_MSG("invalid irq line");
+			return -1;
+		}
+		return 1;
+	case 'C':
+		irq_chip = strdup(optarg);
+		return 1;
+	case 'F':
+		irq_fake_hz = atof(optarg);
+		if (irq_fake_hz <= 0.0) {
+			ERROR_MSG("invalid fake irq rate");
+			return -1;
+		}
+		return 1;
+	case 'p':
+		transport_opts.pipes = atoi(optarg);
+		if (transport_opts.pipes < 1 || transport_opts.pipes > RADIO_PIPES) {
+			ERROR_MSG("invalid number of pipes");
+			return -1;
+		}
+		return 1;
+	case 'T':
+		pipeline = 1;
+		return 1;
+	case 's':
+		stats_on_signal = 1;
+		return 1;
+	case 'm':
+		if (keymap_parse(optarg)) {
+			return -1;
+		}
+		return 1;
+	case OPT_POOL:
+		pool_size = atoi(optarg);
+		if (pool_size < 0 || pool_size > GDD_MAX) {
+			ERROR_MSG("invalid device pool size");
+			return -1;
+		}
+		return 1;
+	case OPT_RX_CPU:
+		rx_cpu = atoi(optarg);
+		return 1;
+	case OPT_EMIT_CPU:
+		emit_cpu = atoi(optarg);
+		return 1;
+	case OPT_DEADZONE:
+		axis_deadzone = atoi(optarg);
+		if (axis_deadzone < 0 || axis_deadzone > 127) {
+			ERROR_MSG("invalid deadzone");
+			return -1;
+		}
+		return 1;
+	case OPT_HYSTERESIS:
+		axis_hysteresis = atoi(optarg);
+		if (axis_hysteresis < 0 || axis_hysteresis > 255) {
+			ERROR_MSG("invalid hysteresis");
+			return -1;
+		}
+		return 1;
+	case OPT_RELEASE_TIMEOUT:
+		release_timeout = atoi(optarg);
+		if (release_timeout < 0) {
+			ERROR_MSG("invalid release timeout");
+			return -1;
+		}
+		return 1;
+	case OPT_IDLE_TIMEOUT:
+		idle_timeout = atoi(optarg);
+		if (idle_timeout < 0) {
+			ERROR_MSG("invalid idle timeout");
+			return -1;
+		}
+		return 1;
+	case OPT_RECORD:
+		record_file = strdup(optarg);
+		return 1;
+	case OPT_REPLAY: {
+		char *spec;
+		ERROR_IF_R(asprintf(&spec, "replay:%s", optarg) < 0, -1, "out of memory");
+		transport_spec = spec;
+		return 1;
+	}
+	case OPT_SPEED:
+		transport_opts.speed = atof(optarg);
+		if (transport_opts.speed < 0.0) {
+			ERROR_MSG("invalid replay speed");
+			return -1;
+		}
+		return 1;
+	case OPT_PROBE:
+		probe_count = atoi(optarg);
+		if (probe_count < 1) {
+			ERROR_MSG("invalid probe frame count");
+			return -1;
+		}
+		return 1;
+	case OPT_PROBE_RATE:
+		probe_rate = atof(optarg);
+		if (probe_rate <= 0.0) {
+			ERROR_MSG("invalid probe rate");
+			return -1;
+		}
+		return 1;
+	case OPT_PROBE_LOAD:
+		probe_load = atoi(optarg);
+		if (probe_load < 0) {
+			ERROR_MSG("invalid probe load");
+			return -1;
+		}
+		return 1;
+	case OPT_METRICS:
+		metrics_socket = strdup(optarg);
+		return 1;
+	case OPT_CONFIG:
+		config_file = strdup(optarg);
+		return 1;
+	case OPT_CHANNEL:
+		channel = conf_channel(optarg);
+		if (channel < 0) {
+			ERROR_MSG("invalid channel");
+			return -1;
+		}
+		return 1;
+	case OPT_DATA_RATE:
+		data_rate = conf_data_rate(optarg);
+		if (data_rate < 0) {
+			ERROR_MSG("invalid data rate");
+			return -1;
+		}
+		return 1;
+	case OPT_HOP:
+		hop_seed = (uint32_t)strtoul(optarg, NULL, 0);
+		if (hop_seed == 0) {
+			ERROR_MSG("hopping seed must be non-zero");
+			return -1;
+		}
+		return 1;
 	}
 	return 0;
 }
@@ -33,11 +299,122 @@ int p_options(int c, char *optarg)
 void p_help(void)
 {
 	printf(
-	    "\n"
+	    "  -t, --transport=NAME[:ARG] where frames are received from, see below, default nrf\n"
+	    "  -r, --rate=HZ              frame rate for generated and replayed frames\n"
+	    "  -i, --irq=LINE             wait for nrf24l01+ irq on gpio LINE instead of polling\n"
+	    "  -C, --irq-chip=DEVICE      gpio character device for irq line, default /dev/gpiochip0\n"
+	    "  -F, --irq-fake=HZ          use fake irq firing at HZ, for testing without irq wiring\n"
+	    "  -p, --pipes=COUNT          number of rx pipes (1-6) each mapped to own controller, default 6\n"
+	    "                             controllers must be built with same CFG_RX_PIPES, on pipe 0\n"
+	    "                             and with single pipe controller id is taken from packet\n"
+	    "      --channel=CHANNEL      radio channel 0-125, default 17\n"
+	    "      --data-rate=KBPS       radio air data rate 250, 1000 or 2000, default 2000\n"
+	    "      --hop=SEED             hop channels in sequence generated from SEED instead of staying\n"
+	    "                             on --channel, controllers must be built with same CFG_HOP_SEED\n"
+	    "  -T, --pipeline             receive radio and write uinput in separate threads\n"
+	    "      --rx-cpu=CPU           pin receiver thread to CPU\n"
+	    "      --emit-cpu=CPU         pin emitter thread to CPU, only with --pipeline\n"
+	    "  -s, --stats                log latency percentiles per stage on SIGUSR1\n"
+	    "  -m, --keymap=[ID=]NAME     button mapping profile for controller ID or for all,\n"
+	    "                             can be given multiple times, see below\n"
+	    "      --pool=COUNT           input devices to create at start and bind to controllers on\n"
+	    "                             first contact, default one per pipe if more than one pipe\n"
+	    "      --deadzone=VALUE       axis values this close to center are centered, default 8\n"
+	    "      --hysteresis=VALUE     axis changes smaller than this are ignored, default 2\n"
+	    "      --release-timeout=MS   release buttons of controller silent this long, default 500, 0 never\n"
+	    "      --idle-timeout=MS      give device of controller silent this long back, default 60000, 0 never\n"
+	    "      --record=FILE          append every valid received frame with its receive time to FILE\n"
+	    "      --replay=FILE          same as --transport=replay:FILE\n"
+	    "      --speed=FACTOR         replay recorded trace this many times faster than it was recorded,\n"
+	    "                             default 1, 0 for as fast as possible\n"
+	    "      --probe=COUNT          measure latency from injected frame to evdev event over COUNT\n"
+	    "                             frames and exit, replaces transport\n"
+	    "      --probe-rate=HZ        probe frame rate, default 250\n"
+	    "      --probe-load=THREADS   busy threads to run as background load while probing, default 0\n"
+	    "      --metrics=SOCKET       serve counters in prometheus text format on unix SOCKET\n"
+	    "      --config=FILE          load settings from FILE and again on SIGHUP, FILE has lines\n"
+	    "                             \"key = value\" with keys channel, data-rate, deadzone, hysteresis\n"
+	    "                             and keymap, values there override command line\n"
+	    "\n");
+	transport_help();
+	keymap_help();
+	printf(
 	    "Gamepad daemon that creates input devices for controller devices found from network.\n"
 	    "\n");
 }
 
+/* write pad state into its device, called from emitter thread in pipeline mode */
+static void emit(struct pad_state *st)
+{
+	uint64_t t_lookup, t_emit, t_done;
+	struct gdd *gdd;
+
+	/* silent controllers */
+	if (st->op != PAD_OP_STATE) {
+		gdd = gdd_get(st->id);
+		if (gdd && st->op == PAD_OP_RELEASE) {
+			gdd_release(gdd, st->t_event);
+		} else if (gdd && st->op == PAD_OP_IDLE) {
+			gdd_destroy(gdd);
+		}
+		return;
+	}
+
+	t_lookup = irq_now();
+	gdd = gdd_get(st->id);
+	if (!gdd) {
+		gdd = gdd_create(st->id, st->flags & GAMEPAD_FLAG_AXES ? GDD_TYPE_AXES : 0);
+	}
+	if (gdd) {
+		const uint8_t *axes = (st->flags & GAMEPAD_FLAG_AXES) && !st->recovered ? st->axes : NULL;
+		const uint16_t *keys = keymap_get(st->id);
+		/* probe measures up to kernel timestamp, so kernel must be the one stamping */
+		uint64_t t_event = probe_count > 0 && st->id == PROBE_ID ? 0 : st->t_event;
+		/* mapping was reloaded, device stays and only its codes change */
+		if (gdd->keys != keys) {
+			gdd_remap(gdd, keys, t_event);
+		}
+		t_emit = irq_now();
+		gdd_set_state(gdd, st->buttons, axes, t_event);
+		t_done = irq_now();
+		stats_add(STATS_LOOKUP, t_lookup, t_emit);
+		stats_add(STATS_EMIT, t_emit, t_done);
+		stats_add(STATS_WAKE, st->t_wake, t_done);
+		stats_add(STATS_TOTAL, st->t_rx, t_done);
+	}
+}
+
+/* pass pad state to emitter, returns 1 if it was queued for emitter thread */
+static int dispatch(struct pad_state *st)
+{
+	if (!pipeline) {
+		emit(st);
+		return 0;
+	}
+	return pipeline_push(st) ? 0 : 1;
+}
+
+/* states queued for emitter since last kick */
+static int queued = 0;
+/* ids with own pipe that frames on shared pipe have claimed, warned only once */
+static uint8_t claimed_warned[RADIO_PIPES];
+
+/* called by reaper for controllers that went silent, goes through emitter like any state */
+static void reap_silent(uint8_t id, int what, uint64_t now)
+{
+	struct pad_state st;
+
+	memset(&st, 0, sizeof(st));
+	st.id = id;
+	st.op = what == REAP_RELEASE ? PAD_OP_RELEASE : PAD_OP_IDLE;
+	st.t_wake = st.t_rx = st.t_event = now;
+	if (what == REAP_IDLE) {
+		/* controller may come back rebooted with new sequence numbers */
+		dedup_reset(id);
+	}
+	queued += dispatch(&st);
+}
+
 void sig_catch_int(int signum)
 {
 	signal(signum, sig_catch_int);
@@ -45,6 +422,18 @@ void sig_catch_int(int signum)
 	p_exit(EXIT_FAILURE);
 }
 
+void sig_catch_usr1(int signum)
+{
+	signal(signum, sig_catch_usr1);
+	stats_requested = 1;
+}
+
+void sig_catch_hup(int signum)
+{
+	signal(signum, sig_catch_hup);
+	reload_requested = 1;
+}
+
 void sig_catch_tstp(int signum)
 {
 	signal(signum, sig_catch_tstp);
@@ -58,14 +447,58 @@ void p_exit(int return_code)
 	if (c > 1) {
 		exit(return_code);
 	}
-	nrf_disable_radio(&nrf);
+	stats_print();
+	metrics_close();
+	probe_stop();
+	probe_print();
+	pipeline_stop();
+	irq_close();
+	transport_close(transport);
+	trace_record_close();
 	gdd_quit();
-	spi_master_close(&master);
 	log_quit();
 	os_quit();
 	exit(return_code);
 }
 
+/* load config file over command line settings, running settings are kept if file has errors */
+static int conf_apply(int reload)
+{
+	struct conf conf = {
+		.channel = channel,
+		.data_rate = data_rate,
+		.deadzone = axis_deadzone,
+		.hysteresis = axis_hysteresis,
+	};
+
+	if (conf_load(config_file, &conf)) {
+		ERROR_MSG("configuration %s not %s", config_file, reload ? "reloaded, keeping current" : "loaded");
+		return -1;
+	}
+
+	/* hopping owns the channel */
+	if (hopper_enabled()) {
+		conf.channel = transport_opts.channel;
+	}
+	/* radio is reprogrammed by receiver thread itself, never while it reads */
+	if (conf.channel != transport_opts.channel || conf.data_rate != transport_opts.data_rate) {
+		transport_opts.channel = conf.channel;
+		transport_opts.data_rate = conf.data_rate;
+		if (reload && transport->reconf) {
+			transport->reconf(transport, &transport_opts);
+			INFO_MSG("radio now on channel %d at %d kbps", transport_opts.channel, transport_opts.data_rate);
+		} else if (reload) {
+			INFO_MSG("transport %s has no radio settings to change", transport->name);
+		}
+	}
+	gdd_set_axis_filter(conf.deadzone, conf.hysteresis);
+	/* emitter picks up new mapping on next state of each controller */
+	keymap_publish(conf.keymaps);
+
+	INFO_MSG("configuration %s %s", config_file, reload ? "reloaded" : "loaded");
+	return 0;
+}
+
 int p_init(int argc, char *argv[])
 {
 	/* very low level platform initialization */
@@ -82,44 +515,210 @@ int p_init(int argc, char *argv[])
 	signal(SIGINT, sig_catch_int);
 	signal(SIGTERM, sig_catch_int);
 	signal(SIGTSTP, sig_catch_tstp);
+	signal(SIGHUP, sig_catch_hup);
+	if (stats_on_signal) {
+		signal(SIGUSR1, sig_catch_usr1);
+	}
+	stats_init();
 
-	/* initialize spi master */
-#ifdef USE_FTDI
-	ERROR_IF_R(common_ftdi_init(), -1, "need to have nrf device connected to ftdi");
-#endif
-	ERROR_IF_R(spi_master_open(
-	               &master, /* must give pre-allocated spi master as pointer */
-	               CFG_SPI_CONTEXT, /* context depends on platform */
-	               CFG_SPI_FREQUENCY,
-	               CFG_SPI_MISO,
-	               CFG_SPI_MOSI,
-	               CFG_SPI_SCLK
-	           ), -1, "failed to open spi master");
-
-	/* nrf initialization */
-	ERROR_IF_R(nrf_open(&nrf, &master, CFG_NRF_SS, CFG_NRF_CE), -1, "nrf24l01+ failed to initialize");
-	/* change channel, default is 70 */
-	nrf_set_channel(&nrf, 17);
-	/* change speed, default is 250k */
-	nrf_set_speed(&nrf, NRF_SPEED_2M);
-	/* enable radio in listen mode */
-	nrf_mode_rx(&nrf);
-	nrf_flush_rx(&nrf);
-	nrf_enable_radio(&nrf);
+	/* real-time scheduling and memory locking before anything is allocated */
+	ERROR_IF_R(common_rt_init(), -1, "failed to apply real-time settings");
+
+	/* probe frames come through simulated radio */
+	if (probe_count > 0) {
+		static char spec[32];
+		int fd = probe_open();
+		ERROR_IF_R(fd < 0, -1, "failed to open probe");
+		snprintf(spec, sizeof(spec), "sim:fd:%d", fd);
+		transport_spec = spec;
+		/* probe finds its device by the path given to devices created on demand */
+		pool_size = 0;
+	}
+
+	/* settings that config file can override */
+	transport_opts.channel = channel;
+	transport_opts.data_rate = data_rate;
+	gdd_set_axis_filter(axis_deadzone, axis_hysteresis);
+	if (config_file) {
+		ERROR_IF_R(conf_apply(0), -1, "failed to load configuration");
+	}
+
+	/* hopping starts from first channel of sequence */
+	if (hop_seed) {
+		transport_opts.channel = hopper_init(hop_seed, irq_now());
+		transport_opts.hop_seed = hop_seed;
+	}
+
+	/* open frame source */
+	transport = transport_open(transport_spec, &transport_opts);
+	ERROR_IF_R(!transport, -1, "failed to open transport");
+	ERROR_IF_R(hop_seed && !transport->reconf, -1, "transport %s can not hop channels", transport->name);
+	if (record_file) {
+		ERROR_IF_R(trace_record_open(record_file), -1, "failed to open trace for recording");
+	}
+
+	/* interrupt source */
+	if (irq_fake_hz > 0.0) {
+		ERROR_IF_R(irq_open_fake(irq_fake_hz), -1, "failed to open fake irq");
+		INFO_MSG("using fake irq at %g Hz", irq_fake_hz);
+	} else if (irq_line >= 0) {
+		ERROR_IF_R(irq_open_gpio(irq_chip, (unsigned int)irq_line), -1, "failed to open irq line");
+		INFO_MSG("using irq from %s line %d", irq_chip, irq_line);
+	} else if (transport->fd >= 0) {
+		ERROR_IF_R(irq_open_fd(transport->fd), -1, "failed to wait on transport");
+	}
 
 	/* initialize broadcast */
 #ifdef USE_BROADCAST
 	ERROR_IF_R(broadcast_init(0), -1, "broadcast failed to initialize");
 #endif
 
-	/* gamepad daemon devices */
-	gdd_init();
+	/* gamepad daemon devices, with one pipe per controller ids are known beforehand */
+	if (pool_size < 0) {
+		pool_size = transport_opts.pipes > 1 ? transport_opts.pipes : 0;
+	}
+	ERROR_IF_R(gdd_init(pool_size), -1, "failed to initialize devices");
+	reap_init(release_timeout, idle_timeout, release_timeout || idle_timeout ? reap_silent : NULL, irq_now());
+
+	/* threads */
+	if (rx_cpu >= 0) {
+		ERROR_IF_R(pipeline_pin(rx_cpu), -1, "failed to pin receiver thread");
+	}
+	if (pipeline) {
+		ERROR_IF_R(pipeline_start(emit, emit_cpu), -1, "failed to start emitter thread");
+		INFO_MSG("pipeline mode, emitter in separate thread");
+	}
+
+	/* tell if any of real-time settings did not take effect */
+	common_rt_check("receiver", pthread_self(), rx_cpu);
+	if (pipeline) {
+		common_rt_check("emitter", pipeline_thread_id(), emit_cpu);
+	}
+
+	if (metrics_socket) {
+		ERROR_IF_R(metrics_open(metrics_socket), -1, "failed to open metrics socket");
+	}
+	if (probe_count > 0) {
+		ERROR_IF_R(probe_start(probe_count, probe_rate, probe_load), -1, "failed to start probe");
+	}
+
+	return 0;
+}
+
+/* read all pending frames from transport, returns -1 if transport was lost */
+static int drain(uint64_t t_wake)
+{
+	int ch;
+
+	while (1) {
+		struct frame f;
+		struct gamepad_state gs;
+		struct pad_state st;
+		uint64_t t_spi, t_valid;
+		int ok, id, missed, verdict;
+
+		t_spi = irq_now();
+		ok = transport->recv(transport, &f);
+		metrics_rx_add(METRICS_RX_SYSCALLS, 1);
+		if (ok < 0) {
+			return -1;
+		} else if (ok == 0) {
+			break;
+		}
+		/* packet has left fifo */
+		st.t_wake = t_wake;
+		st.t_rx = irq_now();
+		stats_add(STATS_SPI, t_spi, st.t_rx);
+		metrics_rx_add(METRICS_RX_FRAMES, 1);
+		/* its acknowledgement took queued position, next frame on this pipe gets a fresh one */
+		if (transport->ack && f.pipe != TRANSPORT_PIPE_NONE) {
+			uint8_t beacon[HOP_BEACON_SIZE];
+			int n = hopper_beacon(beacon);
+			if (n > 0) {
+				transport->ack(transport, f.pipe, beacon, (uint8_t)n);
+			}
+		}
+
+		if (gamepad_decode(f.data, f.len, &gs)) {
+			metrics_rx_add(METRICS_RX_INVALID, 1);
+			continue;
+		}
+		/* everything that passed validation, duplicates included, so replay sees what radio saw */
+		trace_record(st.t_rx, &f);
+		/* with own pipe radio has already told which controller this is */
+		id = transport_frame_id(f.pipe, gs.id, transport_opts.pipes);
+		if (id < 0) {
+			if (!claimed_warned[gs.id]) {
+				WARN_MSG("frames on shared pipe 0 claim controller id %u which has its own pipe, dropping them", gs.id);
+				claimed_warned[gs.id] = 1;
+			}
+			metrics_rx_add(METRICS_RX_INVALID, 1);
+			continue;
+		}
+		st.id = (uint8_t)id;
+		st.op = PAD_OP_STATE;
+		t_valid = irq_now();
+		stats_add(STATS_VALIDATE, st.t_rx, t_valid);
+		/* keepalives are duplicates, but still tell that controller is there */
+		reap_seen(st.id, st.t_rx);
+		metrics_seen(st.id, st.t_rx);
+		hopper_seen(st.id, st.t_rx);
+		/* repeated copies of same state never reach uinput */
+		verdict = dedup_check(st.id, gs.seq, st.t_rx, &missed);
+		if (verdict != DEDUP_ACCEPT) {
+			metrics_rx_add(verdict == DEDUP_DUPLICATE ? METRICS_RX_DUPLICATES : METRICS_RX_OLD, 1);
+			continue;
+		}
+		metrics_rx_add(METRICS_RX_ACCEPTED, 1);
+		metrics_rx_add(METRICS_RX_LOST, (uint64_t)missed);
+		hopper_count(st.id, missed);
+
+		st.flags = gs.flags;
+		memcpy(st.axes, gs.axes, sizeof(st.axes));
+
+		/* replay transitions that were lost, oldest first */
+		if (missed > 0 && gs.history_count > 0) {
+			int n = missed < gs.history_count ? missed : gs.history_count;
+			st.recovered = 1;
+			for (int k = n - 1; k >= 0; k--) {
+				uint64_t age = (uint64_t)gs.history[k].age * 100000ULL;
+				st.buttons = gs.history[k].buttons;
+				st.t_event = st.t_rx > age ? st.t_rx - age : st.t_rx;
+				queued += dispatch(&st);
+			}
+			dedup_recovered(st.id, n);
+			metrics_rx_add(METRICS_RX_RECOVERED, (uint64_t)n);
+		}
+
+		st.recovered = 0;
+		st.buttons = gs.buttons;
+		st.t_event = st.t_rx;
+		queued += dispatch(&st);
+	}
+
+	/* release and give back devices of silent controllers */
+	reap_run(irq_now());
+
+	/* hop only with fifo drained, what is left there would be flushed */
+	ch = hopper_run(irq_now());
+	if (ch >= 0) {
+		transport_opts.channel = ch;
+		transport->reconf(transport, &transport_opts);
+	}
+
+	/* wake emitter once per batch */
+	if (queued > 0) {
+		pipeline_kick();
+		queued = 0;
+	}
 
 	return 0;
 }
 
 int main(int argc, char *argv[])
 {
+	uint64_t t_poll;
+
 	/* init */
 	if (p_init(argc, argv)) {
 		ERROR_MSG("initialization failed");
@@ -128,25 +727,56 @@ int main(int argc, char *argv[])
 
 	/* program loop */
 	INFO_MSG("starting main program loop");
+	t_poll = irq_now();
 	while (1) {
-		struct gamepad_packet pck;
-		int ok;
+		uint64_t t_wake;
 
-		ok = nrf_recv(&nrf, &pck);
-		if (ok < 0) {
-			CRIT_MSG("device disconnected?");
+		if (irq_is_open()) {
+			/* sleep until radio signals, timeout as a safety net for missed edges, for reaper and hopping */
+			int timeout = reap_pending() ? REAP_TICK_MS : 100;
+			int hop_ms = hopper_timeout_ms(irq_now());
+			int ok = irq_wait(hop_ms >= 0 && hop_ms < timeout ? hop_ms : timeout, &t_wake);
+			metrics_rx_add(METRICS_RX_SYSCALLS, 1);
+			if (ok < 0) {
+				CRIT_MSG("waiting for irq failed");
+				break;
+			} else if (ok == 0) {
+				t_wake = irq_now();
+			}
+		} else {
+			/* frame may have arrived any time during poll interval, count from its start */
+			t_wake = t_poll;
+		}
+
+		if (drain(t_wake)) {
+			if (probe_done()) {
+				break;
+			}
+			CRIT_MSG("transport closed or device disconnected");
 			break;
-		} else if (ok > 0 && memcmp(pck.magic, "gamepad\0", 8) == 0) {
-			struct gdd *gdd = gdd_create(1, 0);
-			if (gdd) {
-				gdd_set_buttons(gdd, pck.button);
+		}
+		if (stats_requested) {
+			stats_requested = 0;
+			stats_print();
+		}
+		if (reload_requested) {
+			reload_requested = 0;
+			if (config_file) {
+				conf_apply(1);
+			} else {
+				WARN_MSG("SIGHUP caught, but there is no configuration file to reload");
 			}
 		}
 
-		/* lets not waste all cpu */
-		os_sleepf(0.001);
+		/* lets not waste all cpu when polling */
+		if (!irq_is_open()) {
+			t_poll = irq_now();
+			os_sleepf(0.001);
+			metrics_rx_add(METRICS_RX_SYSCALLS, 1);
+		}
 	}
 
-	p_exit(EXIT_SUCCESS);
+	/* broken probe run must not look like an empty successful one */
+	p_exit(probe_failed() ? EXIT_FAILURE : EXIT_SUCCESS);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,295 @@
+/*
+ * Gamepad daemon runtime counters
+ *
+ * Each connection to the socket gets one snapshot of all counters and is
+ * closed. Clients that send an HTTP request get a minimal HTTP response,
+ * so the socket can be scraped directly, others get plain text.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <libe/log.h>
+#include "metrics.h"
+#include "pipeline.h"
+#include "stats.h"
+
+
+/* how long to wait for request before answering with plain text */
+#define METRICS_REQUEST_MS  100
+#define METRICS_BUF_SIZE    65536
+
+struct metrics_rx metrics_rx;
+struct metrics_emit metrics_emit;
+
+static const char *metrics_rx_names[METRICS_RX_COUNT][2] = {
+	{ "gamepadd_frames_total", "Frames read from transport" },
+	{ "gamepadd_frames_invalid_total", "Frames rejected by version or length" },
+	{ "gamepadd_frames_accepted_total", "Frames carrying new state" },
+	{ "gamepadd_frames_duplicate_total", "Duplicate frames suppressed, keepalives included" },
+	{ "gamepadd_frames_old_total", "Out of order frames older than newest seen" },
+	{ "gamepadd_frames_lost_total", "Frames never received" },
+	{ "gamepadd_states_recovered_total", "Lost states recovered from frame history" },
+	{ "gamepadd_controllers_released_total", "Buttons released because controller went silent" },
+	{ "gamepadd_controllers_idled_total", "Devices returned because controller went silent" },
+	{ "gamepadd_rx_syscalls_total", "Receiver waits and transport reads, one radio read counted once" },
+};
+
+static const char *metrics_emit_names[METRICS_EMIT_COUNT][2] = {
+	{ "gamepadd_uinput_packets_total", "States given to input devices" },
+	{ "gamepadd_uinput_writes_total", "Write syscalls to uinput" },
+	{ "gamepadd_uinput_errors_total", "Failed writes to uinput" },
+	{ "gamepadd_axis_filtered_total", "Axis changes filtered as jitter" },
+};
+
+static char *metrics_path = NULL;
+static int metrics_fd = -1;
+static pthread_t metrics_thread;
+static int metrics_started = 0;
+static char metrics_buf[METRICS_BUF_SIZE];
+
+
+static uint64_t metrics_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* append to buffer, output that does not fit is cut and n never goes past the end */
+static size_t metrics_printf(size_t n, const char *fmt, ...)
+{
+	va_list args;
+	int r;
+
+	if (n >= sizeof(metrics_buf) - 1) {
+		return sizeof(metrics_buf) - 1;
+	}
+	va_start(args, fmt);
+	r = vsnprintf(metrics_buf + n, sizeof(metrics_buf) - n, fmt, args);
+	va_end(args);
+	if (r < 0) {
+		return n;
+	}
+	n += (size_t)r;
+	return n < sizeof(metrics_buf) ? n : sizeof(metrics_buf) - 1;
+}
+
+static size_t metrics_counter(size_t n, const char *name, const char *help, uint64_t value)
+{
+	return metrics_printf(n, "# HELP %s %s.\n# TYPE %s counter\n%s %llu\n",
+	                      name, help, name, name, (unsigned long long)value);
+}
+
+/* stage latency histograms as summaries, values are in nanoseconds */
+static size_t metrics_stages(size_t n)
+{
+	static const double quantiles[] = { 0.5, 0.99, 0.999 };
+
+	n = metrics_printf(n, "# HELP gamepadd_stage_latency_seconds Latency of each receive stage.\n"
+	                      "# TYPE gamepadd_stage_latency_seconds summary\n");
+	for (int i = 0; i < STATS_COUNT; i++) {
+		struct hist *h = &stats_hist[i];
+		for (int q = 0; q < (int)(sizeof(quantiles) / sizeof(quantiles[0])); q++) {
+			n = metrics_printf(n, "gamepadd_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+			                   h->name, quantiles[q], (double)hist_percentile(h, quantiles[q] * 100.0) / 1e9);
+		}
+		n = metrics_printf(n, "gamepadd_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+		                      "gamepadd_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+		                   h->name, (double)METRICS_LOAD(h->sum) / 1e9,
+		                   h->name, (unsigned long long)METRICS_LOAD(h->count));
+	}
+	return n;
+}
+
+static size_t metrics_render(void)
+{
+	uint64_t now = metrics_now();
+	size_t n = 0;
+
+	for (int i = 0; i < METRICS_RX_COUNT; i++) {
+		n = metrics_counter(n, metrics_rx_names[i][0], metrics_rx_names[i][1], METRICS_LOAD(metrics_rx.counters[i]));
+	}
+	for (int i = 0; i < METRICS_EMIT_COUNT; i++) {
+		n = metrics_counter(n, metrics_emit_names[i][0], metrics_emit_names[i][1], METRICS_LOAD(metrics_emit.counters[i]));
+	}
+	if (pipeline_running()) {
+		struct pipeline_stats ps;
+		pipeline_stats(&ps);
+		n = metrics_counter(n, "gamepadd_pipeline_drops_total", "States dropped because emitter ring was full", ps.drops);
+		n = metrics_printf(n, "# HELP gamepadd_pipeline_ring_used States waiting for emitter.\n"
+		                      "# TYPE gamepadd_pipeline_ring_used gauge\ngamepadd_pipeline_ring_used %u\n", ps.used);
+	}
+	n = metrics_stages(n);
+
+	n = metrics_printf(n, "# HELP gamepadd_controller_frames_total Frames received from controller.\n"
+	                      "# TYPE gamepadd_controller_frames_total counter\n");
+	for (int id = 0; id < GDD_MAX; id++) {
+		uint64_t frames = METRICS_LOAD(metrics_rx.frames[id]);
+		if (frames > 0) {
+			n = metrics_printf(n, "gamepadd_controller_frames_total{id=\"%d\"} %llu\n", id, (unsigned long long)frames);
+		}
+	}
+	n = metrics_printf(n, "# HELP gamepadd_controller_last_seen_seconds Time since last frame from controller.\n"
+	                      "# TYPE gamepadd_controller_last_seen_seconds gauge\n");
+	for (int id = 0; id < GDD_MAX; id++) {
+		uint64_t seen;
+		if (METRICS_LOAD(metrics_rx.frames[id]) < 1) {
+			continue;
+		}
+		seen = METRICS_LOAD(metrics_rx.last_seen[id]);
+		n = metrics_printf(n, "gamepadd_controller_last_seen_seconds{id=\"%d\"} %.3f\n",
+		                   id, now > seen ? (double)(now - seen) / 1e9 : 0.0);
+	}
+
+	return n;
+}
+
+static void metrics_serve(int fd)
+{
+	static const char http[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n";
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char req[256];
+	size_t n, off = 0;
+
+	/* anything starting like an http request gets http response */
+	if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0) {
+		ssize_t r = recv(fd, req, sizeof(req), MSG_DONTWAIT);
+		if (r >= 4 && strncmp(req, "GET ", 4) == 0) {
+			if (send(fd, http, sizeof(http) - 1, MSG_NOSIGNAL) < 0) {
+				return;
+			}
+		}
+	}
+
+	n = metrics_render();
+	while (off < n) {
+		ssize_t w = send(fd, metrics_buf + off, n - off, MSG_NOSIGNAL);
+		if (w <= 0) {
+			break;
+		}
+		off += (size_t)w;
+	}
+}
+
+static void *metrics_run(void *arg)
+{
+	while (1) {
+		int fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			/* socket was shut down */
+			break;
+		}
+		metrics_serve(fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* returns 0 if nobody listens on socket, -1 if someone does or it can not be told */
+static int metrics_stale(const struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int err;
+
+	ERROR_IF_R(fd < 0, -1, "socket() failed: %s", strerror(errno));
+	err = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) ? errno : 0;
+	close(fd);
+
+	return err == ECONNREFUSED ? 0 : -1;
+}
+
+int metrics_open(const char *path)
+{
+	struct sockaddr_un addr;
+	pthread_attr_t attr;
+	struct sched_param sp;
+	struct stat st;
+	sigset_t set, old;
+	int err;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	ERROR_IF_R(strlen(path) >= sizeof(addr.sun_path), -1, "metrics socket path too long");
+	strcpy(addr.sun_path, path);
+
+	/*
+	 * Socket left behind by previous run is replaced. One that still
+	 * answers belongs to a running daemon, anything else is not ours.
+	 */
+	if (lstat(path, &st) == 0) {
+		ERROR_IF_R(!S_ISSOCK(st.st_mode), -1, "%s exists and is not a socket", path);
+		ERROR_IF_R(metrics_stale(&addr), -1, "%s is already in use or cannot be checked", path);
+		ERROR_IF_R(unlink(path), -1, "unable to remove old socket %s: %s", path, strerror(errno));
+	}
+
+	metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ERROR_IF_R(metrics_fd < 0, -1, "socket() failed: %s", strerror(errno));
+	if (bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(metrics_fd, 8)) {
+		ERROR_MSG("unable to listen on %s: %s", path, strerror(errno));
+		close(metrics_fd);
+		metrics_fd = -1;
+		return -1;
+	}
+	metrics_path = strdup(path);
+
+	/* serving is never more important than receiving, signals are handled by receiver (main) thread only */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&sp, 0, sizeof(sp));
+	pthread_attr_setschedparam(&attr, &sp);
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	err = pthread_create(&metrics_thread, &attr, metrics_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	if (err) {
+		ERROR_MSG("unable to start metrics thread: %s", strerror(err));
+		metrics_close();
+		return -1;
+	}
+	metrics_started = 1;
+
+	INFO_MSG("serving metrics on %s", path);
+	return 0;
+}
+
+void metrics_close(void)
+{
+	if (metrics_fd >= 0) {
+		/* wakes thread from accept */
+		shutdown(metrics_fd, SHUT_RDWR);
+	}
+	if (metrics_started) {
+		pthread_join(metrics_thread, NULL);
+		metrics_started = 0;
+	}
+	if (metrics_fd >= 0) {
+		close(metrics_fd);
+		metrics_fd = -1;
+	}
+	if (metrics_path) {
+		unlink(metrics_path);
+		free(metrics_path);
+		metrics_path = NULL;
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * Gamepad daemon runtime counters
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "gdd.h"
+
+#define METRICS_CACHE_LINE  64
+
+/* counters written by receiver thread */
+enum {
+	METRICS_RX_FRAMES = 0,  /* frames read from transport */
+	METRICS_RX_INVALID,     /* rejected by version or length */
+	METRICS_RX_ACCEPTED,    /* new states */
+	METRICS_RX_DUPLICATES,  /* copies of seen frames, keepalives included */
+	METRICS_RX_OLD,         /* out of order frames older than newest seen */
+	METRICS_RX_LOST,        /* sequence numbers never seen */
+	METRICS_RX_RECOVERED,   /* lost states recovered from frame history */
+	METRICS_RX_RELEASED,    /* controllers released after silence */
+	METRICS_RX_IDLED,       /* devices returned after longer silence */
+	METRICS_RX_SYSCALLS,    /* waits and transport reads */
+	METRICS_RX_COUNT,
+};
+
+/* counters written by emitter thread, or receiver when not pipelined */
+enum {
+	METRICS_EMIT_PACKETS = 0,   /* states given to devices */
+	METRICS_EMIT_WRITES,        /* uinput write syscalls */
+	METRICS_EMIT_ERRORS,        /* failed uinput writes */
+	METRICS_EMIT_FILTERED,      /* axis changes filtered as jitter */
+	METRICS_EMIT_COUNT,
+};
+
+/*
+ * One block per writing thread on its own cache lines. Each counter has
+ * a single writer, so plain relaxed load and store are enough and
+ * readers from any thread see a consistent enough snapshot.
+ */
+struct metrics_rx {
+	_Alignas(METRICS_CACHE_LINE) _Atomic uint64_t counters[METRICS_RX_COUNT];
+	/* per controller, receive time of last frame in nanoseconds */
+	_Atomic uint64_t last_seen[GDD_MAX];
+	_Atomic uint64_t frames[GDD_MAX];
+};
+
+struct metrics_emit {
+	_Alignas(METRICS_CACHE_LINE) _Atomic uint64_t counters[METRICS_EMIT_COUNT];
+};
+
+extern struct metrics_rx metrics_rx;
+extern struct metrics_emit metrics_emit;
+
+#define METRICS_LOAD(x)     atomic_load_explicit(&(x), memory_order_relaxed)
+#define METRICS_ADD(x, n)   atomic_store_explicit(&(x), METRICS_LOAD(x) + (n), memory_order_relaxed)
+
+static inline void metrics_rx_add(int counter, uint64_t n)
+{
+	METRICS_ADD(metrics_rx.counters[counter], n);
+}
+
+static inline void metrics_emit_add(int counter, uint64_t n)
+{
+	METRICS_ADD(metrics_emit.counters[counter], n);
+}
+
+static inline void metrics_seen(uint8_t id, uint64_t now)
+{
+	atomic_store_explicit(&metrics_rx.last_seen[id], now, memory_order_relaxed);
+	METRICS_ADD(metrics_rx.frames[id], 1);
+}
+
+/**
+ * Serve counters in Prometheus text format on unix socket. Served from
+ * own thread that only reads counters, never takes any lock.
+ *
+ * @param  path     socket path, replaced if left behind by a daemon no longer running
+ * @return          0 on success, -1 on errors
+ */
+int metrics_open(const char *path);
+
+/**
+ * Stop serving and remove socket.
+ */
+void metrics_close(void);
+
+#endif /* _METRICS_H_ */
@@ -0,0 +1,144 @@
+/*
+ * Gamepad daemon receive/emit pipeline
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <libe/log.h>
+#include "pipeline.h"
+
+
+static struct ring pipeline_ring;
+static pthread_t pipeline_thread;
+static int pipeline_efd = -1;
+static atomic_int pipeline_run = 0;
+static _Atomic uint64_t pipeline_pushed = 0;
+static void (*pipeline_emit)(struct pad_state *st) = NULL;
+
+
+static void *pipeline_emitter(void *arg)
+{
+	while (atomic_load(&pipeline_run)) {
+		struct pad_state st;
+		uint64_t v;
+
+		/* empty the ring before sleeping */
+		while (ring_pop(&pipeline_ring, &st)) {
+			pipeline_emit(&st);
+		}
+		if (read(pipeline_efd, &v, sizeof(v)) < 0 && errno != EINTR) {
+			ERROR_MSG("emitter wakeup failed: %s", strerror(errno));
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+int pipeline_start(void (*emit)(struct pad_state *st), int cpu)
+{
+	sigset_t set, old;
+	pthread_attr_t attr;
+	int err;
+
+	ring_init(&pipeline_ring);
+	pipeline_emit = emit;
+	pipeline_efd = eventfd(0, EFD_CLOEXEC);
+	ERROR_IF_R(pipeline_efd < 0, -1, "eventfd() failed: %s", strerror(errno));
+	atomic_store(&pipeline_run, 1);
+
+	/* signals are handled by receiver (main) thread only */
+	/* pinned before it runs, scheduling class is inherited from creator */
+	pthread_attr_init(&attr);
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	err = pthread_create(&pipeline_thread, &attr, pipeline_emitter, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	if (err) {
+		ERROR_MSG("unable to create emitter thread: %s", strerror(err));
+		atomic_store(&pipeline_run, 0);
+		close(pipeline_efd);
+		pipeline_efd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void pipeline_stop(void)
+{
+	struct pipeline_stats stats;
+
+	if (!atomic_load(&pipeline_run)) {
+		return;
+	}
+	atomic_store(&pipeline_run, 0);
+	pipeline_kick();
+	pthread_join(pipeline_thread, NULL);
+	close(pipeline_efd);
+	pipeline_efd = -1;
+
+	pipeline_stats(&stats);
+	INFO_MSG("pipeline: %llu states queued, ring max %u/%d, %u dropped",
+	         (unsigned long long)stats.pushed, stats.max_used, RING_SIZE, stats.drops);
+}
+
+int pipeline_running(void)
+{
+	return atomic_load(&pipeline_run);
+}
+
+int pipeline_push(struct pad_state *st)
+{
+	atomic_fetch_add_explicit(&pipeline_pushed, 1, memory_order_relaxed);
+	return ring_push(&pipeline_ring, st);
+}
+
+pthread_t pipeline_thread_id(void)
+{
+	return pipeline_thread;
+}
+
+void pipeline_kick(void)
+{
+	uint64_t v = 1;
+	if (write(pipeline_efd, &v, sizeof(v)) < 0) {
+		ERROR_MSG("emitter kick failed: %s", strerror(errno));
+	}
+}
+
+void pipeline_stats(struct pipeline_stats *stats)
+{
+	stats->used = ring_used(&pipeline_ring);
+	stats->max_used = atomic_load_explicit(&pipeline_ring.max_used, memory_order_relaxed);
+	stats->drops = atomic_load_explicit(&pipeline_ring.drops, memory_order_relaxed);
+	stats->pushed = atomic_load_explicit(&pipeline_pushed, memory_order_relaxed);
+}
+
+int pipeline_pin(int cpu)
+{
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	ERROR_IF_R(err, -1, "unable to pin thread to cpu %d: %s", cpu, strerror(err));
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Gamepad daemon receive/emit pipeline
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ring.h"
+
+struct pipeline_stats {
+	uint32_t used;
+	uint32_t max_used;
+	uint32_t drops;
+	uint64_t pushed;
+};
+
+/**
+ * Start emitter thread.
+ *
+ * @param  emit     called from emitter thread for each pad state
+ * @param  cpu      cpu to pin emitter thread to, -1 for no pinning
+ * @return          0 on success, -1 on errors
+ */
+int pipeline_start(void (*emit)(struct pad_state *st), int cpu);
+
+/**
+ * Stop and join emitter thread.
+ */
+void pipeline_stop(void);
+
+/**
+ * Check if pipeline is running.
+ */
+int pipeline_running(void);
+
+/**
+ * Queue pad state from receiver thread.
+ *
+ * @return          0 on success, -1 if ring was full and state dropped
+ */
+int pipeline_push(struct pad_state *st);
+
+/**
+ * Get emitter thread, valid only while pipeline is running.
+ */
+pthread_t pipeline_thread_id(void);
+
+/**
+ * Wake emitter after a batch of pushes from receiver thread.
+ */
+void pipeline_kick(void);
+
+/**
+ * Get ring statistics, can be called from any thread.
+ */
+void pipeline_stats(struct pipeline_stats *stats);
+
+/**
+ * Pin calling thread to given cpu.
+ */
+int pipeline_pin(int cpu);
+
+#endif /* _PIPELINE_H_ */
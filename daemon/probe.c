@@ -0,0 +1,330 @@
+/*
+ * Gamepad daemon loopback latency probe
+ *
+ * Injects frames into the daemon through a pipe read by the simulated
+ * radio transport and reads resulting events back from the evdev node of
+ * the created device, grabbed so that nothing else sees them. Each frame
+ * toggles one button, so every frame produces exactly one key event.
+ *
+ * Two latencies are measured from injection: to kernel timestamp of the
+ * event, which is when evdev queued it, and to when reading thread got
+ * it, which is what a game waiting on the device sees. Daemon normally
+ * stamps events with frame receive time, for the probe controller it
+ * leaves the time to kernel.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <linux/input.h>
+#include <libe/log.h>
+#include "probe.h"
+#include "hist.h"
+#include "transport.h"
+#include "../gamepad.h"
+
+
+/* how long to wait for device to appear and for each event */
+#define PROBE_DEVICE_MS     2000
+#define PROBE_EVENT_MS      1000
+#define PROBE_LOAD_MAX      64
+
+static int probe_fds[2] = { -1, -1 };
+static int probe_evdev = -1;
+static int probe_count = 0;
+static uint64_t probe_interval = 0;
+static pthread_t probe_thread;
+static int probe_started = 0;
+static atomic_int probe_running = 0;
+static atomic_int probe_finished = 0;
+static atomic_int probe_error = 0;
+
+static pthread_t probe_loads[PROBE_LOAD_MAX];
+static int probe_load = 0;
+static atomic_int probe_loading = 0;
+
+static struct hist probe_hist_evdev;
+static struct hist probe_hist_read;
+static int probe_measured = 0;
+static int probe_lost = 0;
+
+
+static uint64_t probe_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* device of probe controller is found by its physical path */
+static int probe_find(void)
+{
+	char want[32], phys[64], path[288];
+	struct dirent *de;
+	DIR *dir;
+	int fd = -1;
+
+	snprintf(want, sizeof(want), "gamepadd/id%u", PROBE_ID);
+	dir = opendir("/dev/input");
+	if (!dir) {
+		return -1;
+	}
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, "event", 5)) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+		if (fd < 0) {
+			continue;
+		}
+		memset(phys, 0, sizeof(phys));
+		if (ioctl(fd, EVIOCGPHYS(sizeof(phys) - 1), phys) >= 0 && strcmp(phys, want) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	closedir(dir);
+
+	return fd;
+}
+
+static int probe_attach(void)
+{
+	int clock = CLOCK_MONOTONIC;
+	uint64_t t_end = probe_now() + PROBE_DEVICE_MS * 1000000ULL;
+
+	while ((probe_evdev = probe_find()) < 0) {
+		ERROR_IF_R(probe_now() > t_end, -1, "probe device did not appear");
+		usleep(10000);
+	}
+	/* event times comparable to injection times, no other reader gets events */
+	ERROR_IF_R(ioctl(probe_evdev, EVIOCSCLOCKID, &clock), -1, "unable to set evdev clock: %s", strerror(errno));
+	ERROR_IF_R(ioctl(probe_evdev, EVIOCGRAB, 1), -1, "unable to grab probe device: %s", strerror(errno));
+
+	return 0;
+}
+
+static uint64_t probe_inject(struct gamepad_state *gs)
+{
+	struct transport_record rec;
+	uint64_t t;
+
+	gs->seq++;
+	gs->buttons ^= GAMEPAD_BTN_A;
+	memset(&rec, 0, sizeof(rec));
+	rec.pipe = TRANSPORT_PIPE_NONE;
+	rec.len = (uint8_t)gamepad_encode(gs, rec.data);
+
+	t = probe_now();
+	if (write(probe_fds[1], &rec, sizeof(rec)) != sizeof(rec)) {
+		ERROR_MSG("probe write failed: %s", strerror(errno));
+	}
+	return t;
+}
+
+/* wait for key event and sync that follow, returns -1 on timeout */
+static int probe_read(uint64_t *t_event, uint64_t *t_read)
+{
+	struct pollfd pfd = { .fd = probe_evdev, .events = POLLIN };
+	int key = 0;
+
+	while (1) {
+		struct input_event ev[16];
+		ssize_t n;
+
+		if (poll(&pfd, 1, PROBE_EVENT_MS) < 1) {
+			return -1;
+		}
+		n = read(probe_evdev, ev, sizeof(ev));
+		if (n < (ssize_t)sizeof(ev[0])) {
+			continue;
+		}
+		*t_read = probe_now();
+		for (int i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+			if (ev[i].type == EV_KEY) {
+				*t_event = (uint64_t)ev[i].input_event_sec * 1000000000ULL + (uint64_t)ev[i].input_event_usec * 1000ULL;
+				key = 1;
+			} else if (key && ev[i].type == EV_SYN && ev[i].code == SYN_REPORT) {
+				return 0;
+			}
+		}
+	}
+}
+
+static void *probe_run(void *arg)
+{
+	struct gamepad_state gs;
+	struct timespec next;
+	uint64_t t_next;
+
+	memset(&gs, 0, sizeof(gs));
+	gs.id = PROBE_ID;
+
+	/* first frame creates device */
+	probe_inject(&gs);
+	if (probe_attach()) {
+		atomic_store(&probe_error, 1);
+		atomic_store(&probe_running, 0);
+	}
+
+	t_next = probe_now();
+	for (int i = 0; i < probe_count + PROBE_WARMUP && atomic_load(&probe_running); i++) {
+		uint64_t t_inject, t_event, t_read;
+
+		t_next += probe_interval;
+		next.tv_sec = t_next / 1000000000ULL;
+		next.tv_nsec = t_next % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		t_inject = probe_inject(&gs);
+		if (probe_read(&t_event, &t_read)) {
+			if (i >= PROBE_WARMUP) {
+				probe_lost++;
+			}
+			continue;
+		}
+		if (i < PROBE_WARMUP) {
+			continue;
+		}
+		/* event time is in microseconds, very short latency can round below injection */
+		hist_add(&probe_hist_evdev, t_event > t_inject ? t_event - t_inject : 0);
+		hist_add(&probe_hist_read, t_read - t_inject);
+		probe_measured++;
+	}
+
+	/* end of stream tells receiver that probe is done */
+	atomic_store(&probe_finished, 1);
+	close(probe_fds[1]);
+	probe_fds[1] = -1;
+
+	return NULL;
+}
+
+static void *probe_load_run(void *arg)
+{
+	volatile uint64_t n = 0;
+
+	while (atomic_load(&probe_loading)) {
+		n++;
+	}
+
+	return NULL;
+}
+
+int probe_open(void)
+{
+	int fd;
+
+	ERROR_IF_R(pipe2(probe_fds, O_CLOEXEC), -1, "pipe2() failed: %s", strerror(errno));
+	hist_init(&probe_hist_evdev, "kernel");
+	hist_init(&probe_hist_read, "read");
+	/* transport owns read end */
+	fd = probe_fds[0];
+	probe_fds[0] = -1;
+	return fd;
+}
+
+int probe_start(int count, double rate, int load)
+{
+	pthread_attr_t attr;
+	struct sched_param sp;
+	sigset_t set, old;
+	int err;
+
+	probe_count = count;
+	probe_interval = (uint64_t)(1e9 / rate);
+	atomic_store(&probe_running, 1);
+	/* signals are handled by receiver (main) thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	err = pthread_create(&probe_thread, NULL, probe_run, NULL);
+	if (err) {
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		ERROR_MSG("unable to start probe thread: %s", strerror(err));
+		return -1;
+	}
+	probe_started = 1;
+
+	/* background load never runs real-time, even if daemon does */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&sp, 0, sizeof(sp));
+	pthread_attr_setschedparam(&attr, &sp);
+	atomic_store(&probe_loading, 1);
+	for (probe_load = 0; probe_load < load && probe_load < PROBE_LOAD_MAX; probe_load++) {
+		if (pthread_create(&probe_loads[probe_load], &attr, probe_load_run, NULL)) {
+			ERROR_MSG("unable to start background load thread");
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	INFO_MSG("probing %d frames at %g Hz with %d busy threads as background load", count, rate, probe_load);
+	return 0;
+}
+
+void probe_stop(void)
+{
+	atomic_store(&probe_loading, 0);
+	for (int i = 0; i < probe_load; i++) {
+		pthread_join(probe_loads[i], NULL);
+	}
+	probe_load = 0;
+
+	if (probe_started) {
+		atomic_store(&probe_running, 0);
+		pthread_join(probe_thread, NULL);
+		probe_started = 0;
+	}
+	if (probe_evdev >= 0) {
+		ioctl(probe_evdev, EVIOCGRAB, 0);
+		close(probe_evdev);
+		probe_evdev = -1;
+	}
+	if (probe_fds[1] >= 0) {
+		close(probe_fds[1]);
+		probe_fds[1] = -1;
+	}
+}
+
+int probe_done(void)
+{
+	return atomic_load(&probe_finished);
+}
+
+int probe_failed(void)
+{
+	/* nothing measured is a failure too, there is nothing to compare */
+	return atomic_load(&probe_error) || (atomic_load(&probe_finished) && probe_measured < 1);
+}
+
+void probe_print(void)
+{
+	if (probe_count < 1) {
+		return;
+	}
+	if (probe_failed()) {
+		ERROR_MSG("probe failed: %d frames measured, %d lost", probe_measured, probe_lost);
+		return;
+	}
+	INFO_MSG("probe: %d frames measured, %d lost, latency from injection to evdev kernel timestamp and to client read",
+	         probe_measured, probe_lost);
+	hist_print(&probe_hist_evdev);
+	hist_print(&probe_hist_read);
+}
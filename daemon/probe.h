@@ -0,0 +1,57 @@
+/*
+ * Gamepad daemon loopback latency probe
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <stdint.h>
+
+/* controller id probe frames are sent as, chosen to not collide with real ones */
+#define PROBE_ID            254
+/* samples thrown away while caches and device settle */
+#define PROBE_WARMUP        16
+
+/**
+ * Create pipe that probe frames are injected into.
+ *
+ * @return          read end of pipe for sim:fd:N transport, -1 on errors
+ */
+int probe_open(void);
+
+/**
+ * Start injecting frames and reading them back from evdev.
+ *
+ * @param  count    number of measured frames
+ * @param  rate     frames per second
+ * @param  load     number of busy threads to run as background load
+ * @return          0 on success, -1 on errors
+ */
+int probe_start(int count, double rate, int load);
+
+/**
+ * Stop probe and background load.
+ */
+void probe_stop(void);
+
+/**
+ * Check if all frames have been measured. Pipe is closed when probe is
+ * done, so transport reports end of stream right after.
+ */
+int probe_done(void);
+
+/**
+ * Check if probe was run but did not measure anything, device did not
+ * appear, could not be grabbed or every frame was lost.
+ */
+int probe_failed(void);
+
+/**
+ * Log latency percentiles, does nothing if probe was not run.
+ */
+void probe_print(void);
+
+#endif /* _PROBE_H_ */
@@ -0,0 +1,124 @@
+/*
+ * Gamepad daemon silent controller handling
+ *
+ * Controllers send keepalives while idle, so silence means the link or
+ * the controller is gone. After a short silence everything it held down
+ * is released and after a longer one its device goes back to the pool.
+ *
+ * Frames only store time of last contact. Timer of a controller is not
+ * moved on every frame, when it expires it is checked against last
+ * contact and rearmed if the controller has been heard from since.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stddef.h>
+#include <libe/log.h>
+#include "reap.h"
+#include "wheel.h"
+#include "gdd.h"
+#include "metrics.h"
+
+
+#define REAP_STATE_NONE     0
+#define REAP_STATE_ACTIVE   1
+#define REAP_STATE_RELEASED 2
+
+struct reap {
+	struct wheel_timer timer;
+	uint64_t last_seen;
+	uint8_t state;
+	uint8_t id;
+};
+
+static struct wheel reap_wheel;
+static struct reap reaps[GDD_MAX];
+static uint64_t reap_release_ns = 0;
+static uint64_t reap_idle_ns = 0;
+static void (*reap_cb)(uint8_t id, int what, uint64_t now) = NULL;
+
+
+static void reap_expired(struct wheel_timer *timer, uint64_t now)
+{
+	struct reap *r = (struct reap *)((uint8_t *)timer - offsetof(struct reap, timer));
+	uint64_t silent = now - r->last_seen;
+
+	if (r->state == REAP_STATE_ACTIVE && reap_release_ns) {
+		if (silent < reap_release_ns) {
+			/* heard from since timer was armed */
+			wheel_add(&reap_wheel, &r->timer, r->last_seen + reap_release_ns);
+			return;
+		}
+		INFO_MSG("controller %u silent for %llu ms, releasing buttons", r->id, (unsigned long long)(silent / 1000000));
+		metrics_rx_add(METRICS_RX_RELEASED, 1);
+		reap_cb(r->id, REAP_RELEASE, now);
+		r->state = REAP_STATE_RELEASED;
+		if (reap_idle_ns) {
+			wheel_add(&reap_wheel, &r->timer, r->last_seen + reap_idle_ns);
+		}
+		return;
+	}
+
+	/* released or active without release timeout */
+	if (silent < reap_idle_ns) {
+		wheel_add(&reap_wheel, &r->timer, r->last_seen + reap_idle_ns);
+		return;
+	}
+	INFO_MSG("controller %u silent for %llu ms, returning its device", r->id, (unsigned long long)(silent / 1000000));
+	metrics_rx_add(METRICS_RX_IDLED, 1);
+	r->state = REAP_STATE_NONE;
+	reap_cb(r->id, REAP_IDLE, now);
+}
+
+void reap_init(int release_ms, int idle_ms, void (*cb)(uint8_t id, int what, uint64_t now), uint64_t now)
+{
+	reap_release_ns = (uint64_t)release_ms * 1000000ULL;
+	reap_idle_ns = (uint64_t)idle_ms * 1000000ULL;
+	reap_cb = cb;
+	wheel_init(&reap_wheel, REAP_TICK_MS * 1000000ULL, now);
+	for (int i = 0; i < GDD_MAX; i++) {
+		reaps[i].id = i;
+		reaps[i].state = REAP_STATE_NONE;
+		reaps[i].timer.armed = 0;
+		reaps[i].timer.cb = reap_expired;
+	}
+}
+
+void reap_seen(uint8_t id, uint64_t now)
+{
+	struct reap *r = &reaps[id];
+
+	r->last_seen = now;
+	if (r->state == REAP_STATE_ACTIVE || !reap_cb) {
+		return;
+	}
+	/* first contact or back from silence */
+	r->state = REAP_STATE_ACTIVE;
+	if (reap_release_ns) {
+		wheel_add(&reap_wheel, &r->timer, now + reap_release_ns);
+	} else if (reap_idle_ns) {
+		wheel_add(&reap_wheel, &r->timer, now + reap_idle_ns);
+	} else {
+		wheel_del(&reap_wheel, &r->timer);
+	}
+}
+
+void reap_run(uint64_t now)
+{
+	if (reap_cb) {
+		wheel_run(&reap_wheel, now);
+	}
+}
+
+int reap_pending(void)
+{
+	return reap_cb && wheel_armed(&reap_wheel) > 0;
+}
+
+void reap_print(void)
+{
+	INFO_MSG("silent controllers: %llu released, %llu devices returned",
+	         (unsigned long long)METRICS_LOAD(metrics_rx.counters[METRICS_RX_RELEASED]),
+	         (unsigned long long)METRICS_LOAD(metrics_rx.counters[METRICS_RX_IDLED]));
+}
@@ -0,0 +1,53 @@
+/*
+ * Gamepad daemon silent controller handling
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _REAP_H_
+#define _REAP_H_
+
+#include <stdint.h>
+
+/* wheel tick, timeouts are rounded up to this */
+#define REAP_TICK_MS        10
+
+/* what to do for a silent controller */
+enum {
+	REAP_RELEASE = 1,   /* release all buttons, controller may come back */
+	REAP_IDLE,          /* give device back to pool */
+};
+
+/**
+ * Initialize.
+ * Only receiver thread may call reap functions.
+ *
+ * @param  release_ms   silence before releasing buttons, 0 to disable
+ * @param  idle_ms      silence before device is given back, 0 to disable
+ * @param  cb           called for silent controllers with REAP_RELEASE or REAP_IDLE
+ * @param  now          current time in nanoseconds
+ */
+void reap_init(int release_ms, int idle_ms, void (*cb)(uint8_t id, int what, uint64_t now), uint64_t now);
+
+/**
+ * Mark controller as seen, any frame counts including duplicates.
+ */
+void reap_seen(uint8_t id, uint64_t now);
+
+/**
+ * Run expired timers.
+ */
+void reap_run(uint64_t now);
+
+/**
+ * Check if any controller is being tracked.
+ */
+int reap_pending(void);
+
+/**
+ * Log totals.
+ */
+void reap_print(void);
+
+#endif /* _REAP_H_ */
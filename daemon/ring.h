@@ -0,0 +1,114 @@
+/*
+ * Lock-free single producer single consumer ring
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "../gamepad.h"
+
+/* must be power of two */
+#define RING_SIZE           256
+#define RING_CACHE_LINE     64
+
+/* what emitter should do with pad state */
+enum {
+	PAD_OP_STATE = 0,   /* write state into device */
+	PAD_OP_RELEASE,     /* controller went silent, release everything */
+	PAD_OP_IDLE,        /* controller gone, give device back */
+};
+
+/* decoded state of a single pad */
+struct pad_state {
+	uint64_t t_wake;
+	uint64_t t_rx;
+	/* when state was entered, earlier than t_rx for states recovered from history */
+	uint64_t t_event;
+	uint16_t buttons;
+	uint8_t axes[GAMEPAD_AXES];
+	/* GAMEPAD_FLAG_* of frame */
+	uint8_t flags;
+	/* state was recovered from history and carries only buttons */
+	uint8_t recovered;
+	uint8_t op;
+	uint8_t id;
+};
+
+/*
+ * Producer and consumer indexes live on their own cache lines so that
+ * the two threads do not bounce the same line on every push and pop.
+ */
+struct ring {
+	_Alignas(RING_CACHE_LINE) _Atomic uint32_t head;
+	_Atomic uint32_t drops;
+	_Alignas(RING_CACHE_LINE) _Atomic uint32_t tail;
+	_Atomic uint32_t max_used;
+	_Alignas(RING_CACHE_LINE) struct pad_state items[RING_SIZE];
+};
+
+
+static inline void ring_init(struct ring *ring)
+{
+	atomic_store(&ring->head, 0);
+	atomic_store(&ring->tail, 0);
+	atomic_store(&ring->drops, 0);
+	atomic_store(&ring->max_used, 0);
+}
+
+/**
+ * Push item into ring, producer side only.
+ *
+ * @return 0 on success, -1 if ring was full and item was dropped
+ */
+static inline int ring_push(struct ring *ring, const struct pad_state *item)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail >= RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->drops, 1, memory_order_relaxed);
+		return -1;
+	}
+	ring->items[head & (RING_SIZE - 1)] = *item;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return 0;
+}
+
+/**
+ * Pop item from ring, consumer side only.
+ *
+ * @return 1 if item was popped, 0 if ring is empty
+ */
+static inline int ring_pop(struct ring *ring, struct pad_state *item)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail) {
+		return 0;
+	}
+	if (head - tail > atomic_load_explicit(&ring->max_used, memory_order_relaxed)) {
+		atomic_store_explicit(&ring->max_used, head - tail, memory_order_relaxed);
+	}
+	*item = ring->items[tail & (RING_SIZE - 1)];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+/**
+ * Current number of items in ring, can be called from any thread.
+ */
+static inline uint32_t ring_used(struct ring *ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire) -
+	       atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+#endif /* _RING_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Gamepad daemon per stage latency statistics
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <libe/log.h>
+#include "stats.h"
+#include "pipeline.h"
+#include "dedup.h"
+#include "reap.h"
+#include "hopper.h"
+
+
+struct hist stats_hist[STATS_COUNT];
+
+static const char *stats_names[STATS_COUNT] = {
+	"spi",
+	"validate",
+	"lookup",
+	"emit",
+	"wake",
+	"total",
+};
+
+static int stats_ready = 0;
+
+
+void stats_init(void)
+{
+	for (int i = 0; i < STATS_COUNT; i++) {
+		hist_init(&stats_hist[i], stats_names[i]);
+	}
+	stats_ready = 1;
+}
+
+void stats_print(void)
+{
+	/* exit before init, for example from invalid options */
+	if (!stats_ready) {
+		return;
+	}
+	INFO_MSG("latency per stage:");
+	for (int i = 0; i < STATS_COUNT; i++) {
+		hist_print(&stats_hist[i]);
+	}
+	dedup_print();
+	reap_print();
+	hopper_print();
+	if (pipeline_running()) {
+		struct pipeline_stats ps;
+		pipeline_stats(&ps);
+		INFO_MSG("pipeline ring %u/%d used, max %u, %u dropped",
+		         ps.used, RING_SIZE, ps.max_used, ps.drops);
+	}
+}
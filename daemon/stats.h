@@ -0,0 +1,38 @@
+/*
+ * Gamepad daemon per stage latency statistics
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include "hist.h"
+
+enum {
+	STATS_SPI = 0,      /* reading payload from radio fifo */
+	STATS_VALIDATE,     /* packet validation and decode */
+	STATS_LOOKUP,       /* device lookup or creation */
+	STATS_EMIT,         /* uinput write */
+	STATS_WAKE,         /* irq wakeup or start of poll interval to uinput */
+	STATS_TOTAL,        /* fifo to uinput */
+	STATS_COUNT,
+};
+
+extern struct hist stats_hist[STATS_COUNT];
+
+void stats_init(void);
+
+/**
+ * Log all stage histograms.
+ */
+void stats_print(void);
+
+static inline void stats_add(int stage, uint64_t t_start, uint64_t t_end)
+{
+	hist_add(&stats_hist[stage], t_end - t_start);
+}
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,314 @@
+/*
+ * Gamepad daemon received frame trace
+ *
+ * Recording writes straight into a shared mapping of the file, so the
+ * receive path only does a copy. Address space for the largest trace is
+ * reserved once, a helper thread extends the file under it in large
+ * steps well before receiver gets there. File is cut to its real length
+ * when recording ends.
+ *
+ * With --mlock new mappings are locked as they are made, which would
+ * try to lock the whole reservation. It is mapped with future locking
+ * off and each step is locked when it is grown instead.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <libe/log.h>
+#include "trace.h"
+#include "cmd.h"
+
+
+/* entries added on each growth, about 3 MB */
+#define TRACE_GROW          65536
+/* entries address space is reserved for, 12 GB or 96 MB on 32 bit */
+#if UINTPTR_MAX > 0xffffffffu
+#define TRACE_MAX           ((size_t)TRACE_GROW * 4096)
+#else
+#define TRACE_MAX           ((size_t)TRACE_GROW * 32)
+#endif
+
+_Static_assert(sizeof(struct trace_header) == 64, "trace header size changed");
+_Static_assert(sizeof(struct trace_entry) == 48, "trace entry size changed");
+
+static int trace_fd = -1;
+static uint8_t *trace_base = NULL;
+/* entries file has room for, only grower thread increases it */
+static atomic_size_t trace_capacity = 0;
+static int trace_efd = -1;
+static atomic_int trace_run = 0;
+static int trace_started = 0;
+static pthread_t trace_thread;
+/* frames not recorded because file was not grown in time, receiver only */
+static uint64_t trace_dropped = 0;
+
+
+static size_t trace_bytes(size_t entries)
+{
+	return sizeof(struct trace_header) + entries * sizeof(struct trace_entry);
+}
+
+/* allocate file blocks and fault pages in, so receiver writing there does not have to */
+static int trace_extend(size_t from, size_t to)
+{
+	int err = posix_fallocate(trace_fd, 0, (off_t)trace_bytes(to));
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = trace_bytes(from) & ~(page - 1);
+
+	ERROR_IF_R(err, -1, "unable to grow trace: %s", strerror(err));
+#ifdef MADV_POPULATE_WRITE
+	madvise(trace_base + start, trace_bytes(to) - start, MADV_POPULATE_WRITE);
+#endif
+	ERROR_IF_R(common_rt_mlocked() && mlock(trace_base + start, trace_bytes(to) - start), -1,
+	           "unable to lock grown trace: %s", strerror(errno));
+
+	return 0;
+}
+
+static void trace_kick(void)
+{
+	uint64_t v = 1;
+	if (write(trace_efd, &v, sizeof(v)) < 0) {
+		ERROR_MSG("trace grower kick failed: %s", strerror(errno));
+	}
+}
+
+static void *trace_grower(void *arg)
+{
+	while (atomic_load(&trace_run)) {
+		size_t capacity;
+		uint64_t v;
+
+		if (read(trace_efd, &v, sizeof(v)) < 0 && errno != EINTR) {
+			break;
+		}
+		capacity = atomic_load(&trace_capacity);
+		if (!atomic_load(&trace_run) || capacity >= TRACE_MAX) {
+			continue;
+		}
+		if (trace_extend(capacity, capacity + TRACE_GROW)) {
+			break;
+		}
+		atomic_store_explicit(&trace_capacity, capacity + TRACE_GROW, memory_order_release);
+	}
+
+	return NULL;
+}
+
+int trace_record_open(const char *file)
+{
+	struct trace_header *hdr;
+	struct stat st;
+	size_t capacity = TRACE_GROW;
+	pthread_attr_t attr;
+	struct sched_param sp;
+	sigset_t set, old;
+	int err;
+
+	trace_fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	ERROR_IF_R(trace_fd < 0, -1, "unable to open trace %s: %s", file, strerror(errno));
+	if (fstat(trace_fd, &st)) {
+		ERROR_MSG("unable to stat trace %s: %s", file, strerror(errno));
+		trace_record_close();
+		return -1;
+	}
+
+	/* existing file must be a trace, it is continued from its last complete entry */
+	if (st.st_size > 0) {
+		struct trace_header old;
+		if (pread(trace_fd, &old, sizeof(old), 0) != sizeof(old) || memcmp(old.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+		    old.version != TRACE_VERSION || old.entry_size != sizeof(struct trace_entry)) {
+			ERROR_MSG("%s exists and is not a trace", file);
+			close(trace_fd);
+			trace_fd = -1;
+			return -1;
+		}
+		/* over one step of room, so receiver passes the point where it asks for more */
+		capacity = ((size_t)old.count / TRACE_GROW + 2) * TRACE_GROW;
+		if (capacity > TRACE_MAX) {
+			ERROR_MSG("%s is already as large as a trace can be", file);
+			close(trace_fd);
+			trace_fd = -1;
+			return -1;
+		}
+	}
+
+	/* only current mappings stay locked while reservation is made, future ones are locked again after */
+	if (common_rt_mlocked() && mlockall(MCL_CURRENT)) {
+		ERROR_MSG("unable to turn off future memory locking for trace: %s", strerror(errno));
+		trace_record_close();
+		return -1;
+	}
+	trace_base = mmap(NULL, trace_bytes(TRACE_MAX), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, trace_fd, 0);
+	if (common_rt_mlocked() && mlockall(MCL_FUTURE)) {
+		WARN_MSG("unable to turn future memory locking back on: %s", strerror(errno));
+	}
+	if (trace_base == MAP_FAILED) {
+		ERROR_MSG("unable to map trace: %s", strerror(errno));
+		trace_base = NULL;
+		trace_record_close();
+		return -1;
+	}
+	if (trace_extend(0, capacity)) {
+		trace_record_close();
+		return -1;
+	}
+	atomic_store(&trace_capacity, capacity);
+
+	trace_efd = eventfd(0, EFD_CLOEXEC);
+	if (trace_efd < 0) {
+		ERROR_MSG("eventfd() failed: %s", strerror(errno));
+		trace_record_close();
+		return -1;
+	}
+	/* growing is never more important than receiving, signals are handled by main thread only */
+	atomic_store(&trace_run, 1);
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	memset(&sp, 0, sizeof(sp));
+	pthread_attr_setschedparam(&attr, &sp);
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	err = pthread_create(&trace_thread, &attr, trace_grower, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+	if (err) {
+		ERROR_MSG("unable to create trace thread: %s", strerror(err));
+		trace_record_close();
+		return -1;
+	}
+	trace_started = 1;
+
+	hdr = (struct trace_header *)trace_base;
+	if (st.st_size == 0) {
+		memcpy(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+		hdr->version = TRACE_VERSION;
+		hdr->entry_size = sizeof(struct trace_entry);
+		hdr->count = 0;
+	}
+	INFO_MSG("recording received frames into %s, %llu entries already in it", file, (unsigned long long)hdr->count);
+
+	return 0;
+}
+
+void trace_record(uint64_t t_rx, const struct frame *f)
+{
+	struct trace_header *hdr = (struct trace_header *)trace_base;
+	struct trace_entry *e;
+	size_t capacity;
+
+	if (!trace_base) {
+		return;
+	}
+	capacity = atomic_load_explicit(&trace_capacity, memory_order_acquire);
+	if (hdr->count >= capacity) {
+		/* grower is late, failed or trace is full, never wait for it here */
+		trace_dropped++;
+		return;
+	}
+
+	e = (struct trace_entry *)(trace_base + trace_bytes(hdr->count));
+	e->t_rx = t_rx;
+	e->pipe = f->pipe;
+	e->len = f->len;
+	memcpy(e->data, f->data, sizeof(e->data));
+	memset(e->reserved, 0, sizeof(e->reserved));
+	/* entry must be complete before it is counted */
+	__atomic_store_n(&hdr->count, hdr->count + 1, __ATOMIC_RELEASE);
+
+	/* half a step of room left, ask for more */
+	if (hdr->count + TRACE_GROW / 2 == capacity) {
+		trace_kick();
+	}
+}
+
+void trace_record_close(void)
+{
+	if (trace_started) {
+		atomic_store(&trace_run, 0);
+		trace_kick();
+		pthread_join(trace_thread, NULL);
+		trace_started = 0;
+	}
+	if (trace_efd >= 0) {
+		close(trace_efd);
+		trace_efd = -1;
+	}
+	/* header is only there if file was grown under the mapping */
+	if (trace_base && atomic_load(&trace_capacity) > 0) {
+		struct trace_header *hdr = (struct trace_header *)trace_base;
+		size_t bytes = trace_bytes(hdr->count);
+		INFO_MSG("recorded trace has %llu entries", (unsigned long long)hdr->count);
+		if (trace_dropped > 0) {
+			WARN_MSG("%llu frames were not recorded, trace could not be grown in time", (unsigned long long)trace_dropped);
+		}
+		if (ftruncate(trace_fd, (off_t)bytes)) {
+			ERROR_MSG("unable to truncate trace: %s", strerror(errno));
+		}
+	}
+	if (trace_base) {
+		munmap(trace_base, trace_bytes(TRACE_MAX));
+	}
+	trace_base = NULL;
+	atomic_store(&trace_capacity, 0);
+	trace_dropped = 0;
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+}
+
+const struct trace_entry *trace_map(const char *file, size_t *count, size_t *size)
+{
+	const struct trace_header *hdr;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	ERROR_IF_R(fd < 0, NULL, "unable to open %s: %s", file, strerror(errno));
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct trace_header)) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	ERROR_IF_R(base == MAP_FAILED, NULL, "mmap() failed: %s", strerror(errno));
+
+	hdr = base;
+	if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) || hdr->version != TRACE_VERSION ||
+	    hdr->entry_size != sizeof(struct trace_entry)) {
+		munmap(base, (size_t)st.st_size);
+		return NULL;
+	}
+
+	/* trust count only as far as file really goes */
+	*count = hdr->count;
+	if (trace_bytes(*count) > (size_t)st.st_size) {
+		*count = ((size_t)st.st_size - sizeof(struct trace_header)) / sizeof(struct trace_entry);
+	}
+	*size = (size_t)st.st_size;
+	madvise(base, *size, MADV_SEQUENTIAL);
+
+	return (const struct trace_entry *)((const uint8_t *)base + sizeof(struct trace_header));
+}
+
+void trace_unmap(const struct trace_entry *entries, size_t size)
+{
+	if (entries) {
+		munmap((uint8_t *)entries - sizeof(struct trace_header), size);
+	}
+}
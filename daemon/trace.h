@@ -0,0 +1,75 @@
+/*
+ * Gamepad daemon received frame trace
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "transport.h"
+
+#define TRACE_MAGIC         "gptrace"
+#define TRACE_VERSION       1
+
+/*
+ * File is a header followed by fixed size entries. Count in header is
+ * updated after each entry is complete, so a file left behind by a
+ * crashed daemon is valid up to the last full entry.
+ */
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	/* complete entries in file */
+	uint64_t count;
+	uint8_t reserved[40];
+};
+
+struct trace_entry {
+	/* CLOCK_MONOTONIC receive time in nanoseconds */
+	uint64_t t_rx;
+	uint8_t pipe;
+	uint8_t len;
+	uint8_t data[TRANSPORT_FRAME_MAX];
+	uint8_t reserved[6];
+};
+
+/**
+ * Open trace for recording, existing trace is appended to.
+ * Only receiver thread may record.
+ *
+ * @param  file     trace file
+ * @return          0 on success, -1 on errors
+ */
+int trace_record_open(const char *file);
+
+/**
+ * Append frame into trace, does nothing if trace is not open.
+ */
+void trace_record(uint64_t t_rx, const struct frame *f);
+
+/**
+ * Close recorded trace.
+ */
+void trace_record_close(void);
+
+/**
+ * Map trace for reading.
+ *
+ * @param  file     trace file
+ * @param  count    number of entries
+ * @param  size     size of mapping, needed for trace_unmap()
+ * @return          entries, NULL if file is not a trace or on errors
+ */
+const struct trace_entry *trace_map(const char *file, size_t *count, size_t *size);
+
+/**
+ * Unmap trace mapped with trace_map().
+ */
+void trace_unmap(const struct trace_entry *entries, size_t size);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,64 @@
+/*
+ * Gamepad daemon frame transports
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <libe/log.h>
+#include "transport.h"
+
+
+static struct transport *transports[] = {
+	&transport_nrf,
+	&transport_sim,
+	&transport_replay,
+	&transport_udp,
+	NULL
+};
+
+
+struct transport *transport_open(const char *spec, struct transport_opts *opts)
+{
+	const char *arg = strchr(spec, ':');
+	size_t n = arg ? (size_t)(arg - spec) : strlen(spec);
+
+	for (int i = 0; transports[i]; i++) {
+		struct transport *t = transports[i];
+		if (strlen(t->name) != n || strncmp(t->name, spec, n) != 0) {
+			continue;
+		}
+		t->fd = -1;
+		t->priv = NULL;
+		ERROR_IF_R(t->open(t, arg ? arg + 1 : NULL, opts), NULL, "failed to open transport %s", t->name);
+		return t;
+	}
+
+	ERROR_MSG("unknown transport: %s", spec);
+	return NULL;
+}
+
+void transport_close(struct transport *t)
+{
+	if (t) {
+		t->close(t);
+	}
+}
+
+void transport_help(void)
+{
+	printf(
+	    "Transports:\n"
+	    "  nrf                        nRF24L01+ radio, default\n"
+	    "  sim:FILE                   simulated radio reading records from FILE (regular file or fifo)\n"
+	    "  sim:fd:N                   simulated radio reading records from inherited socket or pipe N\n"
+	    "  sim:gen                    simulated radio generating frames for all pipes at --rate\n"
+	    "  sim:gen:MODEL              same, MODEL is interference as CH[-CH]=PERCENT,... and PERCENT\n"
+	    "                             of frames sent on channels CH are lost\n"
+	    "  replay:FILE                replay trace recorded with --record from FILE at --speed,\n"
+	    "                             or plain records at --rate, as fast as possible if rate is 0\n"
+	    "  udp[:PORT]                 network controllers sending frames to udp PORT, default 7777\n"
+	    "\n");
+}
@@ -0,0 +1,105 @@
+/*
+ * Gamepad daemon frame transports
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include <stdint.h>
+
+#define TRANSPORT_FRAME_MAX     32
+/* frame did not come through a radio pipe, controller id is in payload */
+#define TRANSPORT_PIPE_NONE     0xff
+
+/**
+ * Controller id of frame. Pipes 1-5 each belong to one controller, pipe 0
+ * is shared by controllers that have no pipe of their own, so there and
+ * on transports without pipes the id in payload tells. Frame on shared
+ * pipe can not claim id of a controller that has its own pipe, it would
+ * be merged with that controller.
+ *
+ * @param  pipes    number of radio pipes in use
+ * @return          controller id, -1 if frame on shared pipe claims id owned by another pipe
+ */
+static inline int transport_frame_id(uint8_t pipe, uint8_t payload_id, int pipes)
+{
+	if (pipe != 0 && pipe != TRANSPORT_PIPE_NONE) {
+		return pipe;
+	}
+	if (pipe == 0 && payload_id > 0 && payload_id < pipes) {
+		return -1;
+	}
+	return payload_id;
+}
+
+struct frame {
+	uint8_t pipe;
+	uint8_t len;
+	uint8_t data[TRANSPORT_FRAME_MAX];
+};
+
+/* record format used by simulated and replayed streams */
+struct transport_record {
+	uint8_t pipe;
+	uint8_t len;
+	uint8_t data[TRANSPORT_FRAME_MAX];
+};
+
+struct transport_opts {
+	/* number of radio pipes in use */
+	int pipes;
+	/* radio channel and air data rate in kbps */
+	int channel;
+	int data_rate;
+	/* frame rate for generated and replayed streams, 0 for as fast as possible */
+	double rate;
+	/* speed of recorded trace replay relative to original, 0 for as fast as possible */
+	double speed;
+	/* hopping sequence seed for generated controllers to follow, 0 when channel is fixed */
+	uint32_t hop_seed;
+};
+
+struct transport {
+	const char *name;
+	int (*open)(struct transport *t, const char *arg, struct transport_opts *opts);
+	void (*close)(struct transport *t);
+	/* returns 1 when frame was received, 0 when nothing is pending, -1 on errors or end of stream */
+	int (*recv)(struct transport *t, struct frame *f);
+	/* apply changed radio settings in place, NULL if transport has none */
+	int (*reconf)(struct transport *t, struct transport_opts *opts);
+	/* queue payload for next acknowledgement on pipe, dropped by reconf, NULL if transport has no acknowledgements */
+	int (*ack)(struct transport *t, uint8_t pipe, const uint8_t *data, uint8_t len);
+
+	/* pollable file descriptor, -1 if transport must be polled */
+	int fd;
+	void *priv;
+};
+
+/**
+ * Open transport.
+ *
+ * @param  spec     transport name and optional argument as "NAME[:ARG]"
+ * @param  opts     options
+ * @return          opened transport or NULL on errors
+ */
+struct transport *transport_open(const char *spec, struct transport_opts *opts);
+
+/**
+ * Close transport.
+ */
+void transport_close(struct transport *t);
+
+/**
+ * Print help for available transports.
+ */
+void transport_help(void);
+
+extern struct transport transport_nrf;
+extern struct transport transport_sim;
+extern struct transport transport_replay;
+extern struct transport transport_udp;
+
+#endif /* _TRANSPORT_H_ */
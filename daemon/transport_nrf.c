@@ -0,0 +1,96 @@
+/*
+ * Gamepad daemon nRF24L01+ transport
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <libe/log.h>
+#include <libe/os.h>
+#include <libe/drivers/spi/nrf.h>
+#include "transport.h"
+#include "cmd.h"
+#include "../config.h"
+#include "../radio.h"
+
+
+static struct spi_master master;
+static struct nrf_device nrf;
+
+
+static int nrf_t_open(struct transport *t, const char *arg, struct transport_opts *opts)
+{
+	/* initialize spi master */
+#ifdef USE_FTDI
+	ERROR_IF_R(common_ftdi_init(), -1, "need to have nrf device connected to ftdi");
+#endif
+	ERROR_IF_R(spi_master_open(
+	               &master, /* must give pre-allocated spi master as pointer */
+	               CFG_SPI_CONTEXT, /* context depends on platform */
+	               CFG_SPI_FREQUENCY,
+	               CFG_SPI_MISO,
+	               CFG_SPI_MOSI,
+	               CFG_SPI_SCLK
+	           ), -1, "failed to open spi master");
+
+	/* nrf initialization */
+	ERROR_IF_R(nrf_open(&nrf, &master, CFG_NRF_SS, CFG_NRF_CE), -1, "nrf24l01+ failed to initialize");
+	/* change channel and speed, defaults are 70 and 250k */
+	nrf_set_channel(&nrf, opts->channel);
+	radio_data_rate(&nrf, opts->data_rate);
+	/* each pipe has its own address, radio demultiplexes controllers */
+	radio_rx_pipes(&nrf, opts->pipes);
+	/* enable radio in listen mode */
+	nrf_mode_rx(&nrf);
+	nrf_flush_rx(&nrf);
+	nrf_enable_radio(&nrf);
+
+	return 0;
+}
+
+static int nrf_t_reconf(struct transport *t, struct transport_opts *opts)
+{
+	/*
+	 * Rf settings are changed in standby, pipes and addresses stay.
+	 * Rx fifo is kept, frames in it were already acknowledged to
+	 * controllers and are read by next drain like any other.
+	 * Queued acknowledgement payloads describe previous channel.
+	 */
+	nrf_disable_radio(&nrf);
+	radio_ack_flush(&nrf);
+	nrf_set_channel(&nrf, opts->channel);
+	radio_data_rate(&nrf, opts->data_rate);
+	nrf_enable_radio(&nrf);
+
+	return 0;
+}
+
+static int nrf_t_ack(struct transport *t, uint8_t pipe, const uint8_t *data, uint8_t len)
+{
+	return radio_ack_payload(&nrf, pipe, data, len);
+}
+
+static void nrf_t_close(struct transport *t)
+{
+	nrf_disable_radio(&nrf);
+	spi_master_close(&master);
+}
+
+static int nrf_t_recv(struct transport *t, struct frame *f)
+{
+	int n = radio_recv(&nrf, f->data, &f->pipe, 1);
+	if (n > 0) {
+		f->len = (uint8_t)n;
+		return 1;
+	}
+	return n;
+}
+
+struct transport transport_nrf = {
+	.name = "nrf",
+	.open = nrf_t_open,
+	.close = nrf_t_close,
+	.recv = nrf_t_recv,
+	.reconf = nrf_t_reconf,
+	.ack = nrf_t_ack,
+};
@@ -0,0 +1,198 @@
+/*
+ * Gamepad daemon replay transport
+ *
+ * Plays frames from file for benchmarks. Traces recorded with --record
+ * are played with their original timing scaled by --speed, plain
+ * transport records at fixed rate.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <libe/log.h>
+#include "transport.h"
+#include "trace.h"
+
+
+static const struct transport_record *replay_recs = NULL;
+static size_t replay_count = 0;
+static size_t replay_pos = 0;
+static size_t replay_size = 0;
+static int replay_timer = -1;
+static uint64_t replay_pending = 0;
+
+/* recorded trace, played with original timing */
+static const struct trace_entry *replay_trace = NULL;
+static double replay_speed = 1.0;
+static uint64_t replay_start = 0;
+
+
+static uint64_t replay_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int replay_open_trace(struct transport *t, const char *arg, struct transport_opts *opts)
+{
+	replay_pos = 0;
+	replay_start = 0;
+	replay_speed = opts->speed;
+
+	if (replay_speed > 0.0) {
+		struct itimerspec its;
+		replay_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		ERROR_IF_R(replay_timer < 0, -1, "timerfd_create() failed: %s", strerror(errno));
+		/* fire at once so that first receive starts the clock */
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = 1;
+		timerfd_settime(replay_timer, 0, &its, NULL);
+		t->fd = replay_timer;
+		INFO_MSG("replaying %zu frames from trace %s at %gx speed", replay_count, arg, replay_speed);
+	} else {
+		INFO_MSG("replaying %zu frames from trace %s as fast as possible", replay_count, arg);
+	}
+
+	return 0;
+}
+
+
+static int replay_open(struct transport *t, const char *arg, struct transport_opts *opts)
+{
+	struct stat st;
+	int fd;
+
+	ERROR_IF_R(!arg, -1, "replay needs a file");
+	replay_trace = trace_map(arg, &replay_count, &replay_size);
+	if (replay_trace) {
+		return replay_open_trace(t, arg, opts);
+	}
+
+	fd = open(arg, O_RDONLY | O_CLOEXEC);
+	ERROR_IF_R(fd < 0, -1, "unable to open %s: %s", arg, strerror(errno));
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct transport_record)) {
+		ERROR_MSG("replay file %s is empty", arg);
+		close(fd);
+		return -1;
+	}
+	replay_size = (size_t)st.st_size;
+	replay_recs = mmap(NULL, replay_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	ERROR_IF_R(replay_recs == MAP_FAILED, -1, "mmap() failed: %s", strerror(errno));
+	madvise((void *)replay_recs, replay_size, MADV_SEQUENTIAL);
+	replay_count = replay_size / sizeof(struct transport_record);
+	replay_pos = 0;
+	replay_pending = 0;
+
+	if (opts->rate > 0.0) {
+		struct itimerspec its;
+		long ns = (long)(1e9 / opts->rate);
+		replay_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		ERROR_IF_R(replay_timer < 0, -1, "timerfd_create() failed: %s", strerror(errno));
+		memset(&its, 0, sizeof(its));
+		its.it_interval.tv_sec = ns / 1000000000L;
+		its.it_interval.tv_nsec = ns % 1000000000L;
+		its.it_value = its.it_interval;
+		timerfd_settime(replay_timer, 0, &its, NULL);
+		t->fd = replay_timer;
+	}
+
+	INFO_MSG("replaying %zu records from %s", replay_count, arg);
+	return 0;
+}
+
+static void replay_close(struct transport *t)
+{
+	if (replay_recs && replay_recs != MAP_FAILED) {
+		munmap((void *)replay_recs, replay_size);
+	}
+	replay_recs = NULL;
+	trace_unmap(replay_trace, replay_size);
+	replay_trace = NULL;
+	if (replay_timer >= 0) {
+		close(replay_timer);
+		replay_timer = -1;
+	}
+}
+
+static int replay_recv_trace(struct transport *t, struct frame *f)
+{
+	const struct trace_entry *e = &replay_trace[replay_pos];
+
+	/* frame is due when as much time has passed since start as passed in recording */
+	if (replay_timer >= 0) {
+		uint64_t expirations, now, due;
+		if (read(replay_timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+			ERROR_MSG("replay timer failed: %s", strerror(errno));
+			return -1;
+		}
+		now = replay_now();
+		if (!replay_start) {
+			replay_start = now;
+		}
+		due = replay_start + (uint64_t)((double)(e->t_rx - replay_trace[0].t_rx) / replay_speed);
+		if (now < due) {
+			struct itimerspec its;
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = due / 1000000000ULL;
+			its.it_value.tv_nsec = due % 1000000000ULL;
+			timerfd_settime(replay_timer, TFD_TIMER_ABSTIME, &its, NULL);
+			return 0;
+		}
+	}
+
+	replay_pos++;
+	f->pipe = e->pipe;
+	f->len = e->len > TRANSPORT_FRAME_MAX ? TRANSPORT_FRAME_MAX : e->len;
+	memcpy(f->data, e->data, sizeof(f->data));
+
+	return 1;
+}
+
+static int replay_recv(struct transport *t, struct frame *f)
+{
+	const struct transport_record *rec;
+
+	if (replay_pos >= replay_count) {
+		INFO_MSG("replay finished");
+		return -1;
+	}
+	if (replay_trace) {
+		return replay_recv_trace(t, f);
+	}
+
+	/* paced replay, one record per timer expiration */
+	if (replay_timer >= 0) {
+		if (replay_pending < 1) {
+			uint64_t expirations;
+			if (read(replay_timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+				return 0;
+			}
+			replay_pending = expirations;
+		}
+		replay_pending--;
+	}
+
+	rec = &replay_recs[replay_pos++];
+	f->pipe = rec->pipe;
+	f->len = rec->len > TRANSPORT_FRAME_MAX ? TRANSPORT_FRAME_MAX : rec->len;
+	memcpy(f->data, rec->data, sizeof(f->data));
+
+	return 1;
+}
+
+struct transport transport_replay = {
+	.name = "replay",
+	.open = replay_open,
+	.close = replay_close,
+	.recv = replay_recv,
+};
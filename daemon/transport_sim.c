@@ -0,0 +1,262 @@
+/*
+ * Gamepad daemon simulated radio transport
+ *
+ * Reads transport records from a file, fifo or inherited socket,
+ * or generates synthetic frames for all pipes.
+ *
+ * Generated frames can be lost by channel they are sent on, to test
+ * hopping without radios. Without hopping simulated controllers are on
+ * receiver channel. With it each pipe is a controller following receiver
+ * like real ones do, from acknowledgement payloads and its own clock that
+ * runs one millisecond per generated frame, real time at default rate.
+ * Each generated frame is one send, acknowledged only if receiver is on
+ * the same channel and interference does not take it.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <libe/log.h>
+#include "transport.h"
+#include "../gamepad.h"
+#include "../hop.h"
+
+
+static int sim_fd = -1;
+static int sim_gen = 0;
+static int sim_pipes = 1;
+static uint64_t sim_pending = 0;
+static uint32_t sim_counter = 0;
+static struct transport_record sim_rec;
+static size_t sim_fill = 0;
+
+/* interference model, percent of generated frames lost on each channel */
+#define SIM_CHANNELS        126
+static uint8_t sim_loss[SIM_CHANNELS];
+static int sim_channel = 0;
+static unsigned int sim_seed = 1;
+
+/* controllers following hopping receiver, one per pipe, and acknowledgement payloads queued for them */
+#define SIM_PIPES           8
+static int sim_hopping = 0;
+static struct hop sim_hop[SIM_PIPES];
+static uint8_t sim_ack[SIM_PIPES][TRANSPORT_FRAME_MAX];
+static uint8_t sim_ack_len[SIM_PIPES];
+
+
+static int sim_timer(double rate)
+{
+	struct itimerspec its;
+	long ns = (long)(1e9 / rate);
+
+	sim_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	ERROR_IF_R(sim_fd < 0, -1, "timerfd_create() failed: %s", strerror(errno));
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = ns / 1000000000L;
+	its.it_interval.tv_nsec = ns % 1000000000L;
+	its.it_value = its.it_interval;
+	timerfd_settime(sim_fd, 0, &its, NULL);
+
+	return 0;
+}
+
+/* parse "CH[-CH]=PERCENT[,...]" */
+static int sim_interference(const char *spec)
+{
+	while (*spec) {
+		char *end;
+		long first, last, loss;
+
+		first = last = strtol(spec, &end, 10);
+		if (*end == '-') {
+			last = strtol(end + 1, &end, 10);
+		}
+		ERROR_IF_R(*end != '=', -1, "expected CH[-CH]=PERCENT in interference model");
+		loss = strtol(end + 1, &end, 10);
+		ERROR_IF_R(first < 0 || last >= SIM_CHANNELS || first > last, -1, "invalid channel range in interference model");
+		ERROR_IF_R(loss < 0 || loss > 100, -1, "invalid loss percent in interference model");
+		ERROR_IF_R(*end != ',' && *end != '\0', -1, "expected CH[-CH]=PERCENT in interference model");
+		for (long ch = first; ch <= last; ch++) {
+			sim_loss[ch] = (uint8_t)loss;
+		}
+		spec = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+static int sim_open(struct transport *t, const char *arg, struct transport_opts *opts)
+{
+	struct stat st;
+
+	ERROR_IF_R(!arg, -1, "simulated radio needs an argument");
+	sim_pipes = opts->pipes;
+	sim_pending = 0;
+	sim_counter = 0;
+	sim_fill = 0;
+	sim_gen = 0;
+	sim_channel = opts->channel;
+	memset(sim_loss, 0, sizeof(sim_loss));
+	memset(sim_ack_len, 0, sizeof(sim_ack_len));
+	sim_hopping = opts->hop_seed != 0;
+	for (int i = 0; i < SIM_PIPES; i++) {
+		hop_init(&sim_hop[i], opts->hop_seed);
+	}
+	ERROR_IF_R(sim_pipes < 1 || sim_pipes > SIM_PIPES, -1, "simulated radio has 1-%d pipes", SIM_PIPES);
+
+	if (strcmp(arg, "gen") == 0 || strncmp(arg, "gen:", 4) == 0) {
+		double rate = opts->rate > 0.0 ? opts->rate : 1000.0;
+		if (arg[3] == ':') {
+			ERROR_IF_R(sim_interference(arg + 4), -1, "invalid interference model");
+		}
+		ERROR_IF_R(sim_timer(rate), -1, "unable to start frame generator");
+		sim_gen = 1;
+		t->fd = sim_fd;
+		INFO_MSG("simulated radio generating %g frames per second over %d pipe(s)", rate, sim_pipes);
+		return 0;
+	} else if (strncmp(arg, "fd:", 3) == 0) {
+		sim_fd = atoi(arg + 3);
+	} else {
+		sim_fd = open(arg, O_RDONLY | O_CLOEXEC);
+		ERROR_IF_R(sim_fd < 0, -1, "unable to open %s: %s", arg, strerror(errno));
+	}
+	fcntl(sim_fd, F_SETFL, fcntl(sim_fd, F_GETFL) | O_NONBLOCK);
+
+	/* regular files cannot be waited on, they are always readable anyway */
+	ERROR_IF_R(fstat(sim_fd, &st), -1, "fstat() failed: %s", strerror(errno));
+	t->fd = S_ISREG(st.st_mode) ? -1 : sim_fd;
+
+	return 0;
+}
+
+static int sim_reconf(struct transport *t, struct transport_opts *opts)
+{
+	sim_channel = opts->channel;
+	/* like radio, payloads queued on previous channel are dropped */
+	memset(sim_ack_len, 0, sizeof(sim_ack_len));
+	return 0;
+}
+
+static int sim_ack_queue(struct transport *t, uint8_t pipe, const uint8_t *data, uint8_t len)
+{
+	if (!sim_gen || pipe >= sim_pipes || len > TRANSPORT_FRAME_MAX) {
+		return -1;
+	}
+	memcpy(sim_ack[pipe], data, len);
+	sim_ack_len[pipe] = len;
+	return 0;
+}
+
+/* one send of generated frame, returns 1 if receiver got it */
+static int sim_send(uint8_t pipe)
+{
+	struct hop *hop = &sim_hop[pipe];
+	int channel = sim_hopping ? hop_channel(hop) : sim_channel;
+
+	if (channel == sim_channel && (sim_loss[channel] < 1 || (int)(rand_r(&sim_seed) % 100) >= sim_loss[channel])) {
+		if (sim_hopping) {
+			hop_heard(hop, sim_ack[pipe], sim_ack_len[pipe], sim_counter);
+		}
+		sim_ack_len[pipe] = 0;
+		return 1;
+	}
+	if (sim_hopping) {
+		hop_missed(hop, sim_counter);
+	}
+	return 0;
+}
+
+static void sim_close(struct transport *t)
+{
+	if (sim_fd >= 0) {
+		close(sim_fd);
+		sim_fd = -1;
+	}
+}
+
+static int sim_generate(struct frame *f)
+{
+	struct gamepad_state gs;
+	uint64_t expirations;
+
+	/* frames that were not received still use their sequence number */
+	while (1) {
+		if (sim_pending < 1) {
+			if (read(sim_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+				return 0;
+			}
+			sim_pending = expirations;
+		}
+		sim_pending--;
+		if (sim_send(sim_counter % sim_pipes)) {
+			break;
+		}
+		sim_counter++;
+	}
+
+	/* walk through pipes, each one toggling its own button pattern */
+	memset(&gs, 0, sizeof(gs));
+	f->pipe = sim_counter % sim_pipes;
+	gs.id = f->pipe;
+	gs.seq = (uint8_t)(sim_counter / sim_pipes);
+	gs.buttons = (uint16_t)(1 << ((sim_counter / sim_pipes) % GAMEPAD_BUTTONS));
+	/* odd pipes are analog: slow sweep on one axis, one step of jitter on others */
+	if (f->pipe & 1) {
+		gs.flags |= GAMEPAD_FLAG_AXES;
+		gs.axes[0] = (uint8_t)(sim_counter / sim_pipes / 4);
+		for (int i = 1; i < GAMEPAD_AXES; i++) {
+			gs.axes[i] = GAMEPAD_AXIS_CENTER + (sim_counter / sim_pipes) % 3 - 1;
+		}
+	}
+	f->len = (uint8_t)gamepad_encode(&gs, f->data);
+	sim_counter++;
+
+	return 1;
+}
+
+static int sim_recv(struct transport *t, struct frame *f)
+{
+	if (sim_gen) {
+		return sim_generate(f);
+	}
+
+	while (1) {
+		ssize_t n = read(sim_fd, (uint8_t *)&sim_rec + sim_fill, sizeof(sim_rec) - sim_fill);
+		if (n == 0) {
+			INFO_MSG("simulated radio stream ended");
+			return -1;
+		} else if (n < 0) {
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+		sim_fill += (size_t)n;
+		if (sim_fill < sizeof(sim_rec)) {
+			continue;
+		}
+		sim_fill = 0;
+
+		/* simulate radio limits, drop what real radio would not receive */
+		if (sim_rec.len > TRANSPORT_FRAME_MAX || (sim_rec.pipe >= sim_pipes && sim_rec.pipe != TRANSPORT_PIPE_NONE)) {
+			continue;
+		}
+		f->pipe = sim_rec.pipe;
+		f->len = sim_rec.len;
+		memcpy(f->data, sim_rec.data, sizeof(f->data));
+		return 1;
+	}
+}
+
+struct transport transport_sim = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.recv = sim_recv,
+	.reconf = sim_reconf,
+	.ack = sim_ack_queue,
+};
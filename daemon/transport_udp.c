@@ -0,0 +1,106 @@
+/*
+ * Gamepad daemon UDP transport for network controllers
+ *
+ * Frames are received in batches with recvmmsg() into buffers
+ * allocated once at open.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <libe/log.h>
+#include "transport.h"
+
+
+#define UDP_BATCH           64
+#define UDP_DEFAULT_PORT    7777
+
+static int udp_fd = -1;
+static struct mmsghdr udp_msgs[UDP_BATCH];
+static struct iovec udp_iovs[UDP_BATCH];
+static uint8_t udp_bufs[UDP_BATCH][TRANSPORT_FRAME_MAX];
+static int udp_count = 0;
+static int udp_pos = 0;
+
+
+static int udp_open(struct transport *t, const char *arg, struct transport_opts *opts)
+{
+	struct sockaddr_in addr;
+	int port = arg ? atoi(arg) : UDP_DEFAULT_PORT;
+	int rcvbuf = 4 * 1024 * 1024;
+
+	ERROR_IF_R(port < 1 || port > 0xffff, -1, "invalid udp port");
+	udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	ERROR_IF_R(udp_fd < 0, -1, "socket() failed: %s", strerror(errno));
+	/* bursts from hundreds of controllers must fit into socket buffer */
+	setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((uint16_t)port);
+	if (bind(udp_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ERROR_MSG("unable to bind udp port %d: %s", port, strerror(errno));
+		close(udp_fd);
+		udp_fd = -1;
+		return -1;
+	}
+
+	/* message headers point to fixed buffers and are reused for every batch */
+	memset(udp_msgs, 0, sizeof(udp_msgs));
+	for (int i = 0; i < UDP_BATCH; i++) {
+		udp_iovs[i].iov_base = udp_bufs[i];
+		udp_iovs[i].iov_len = TRANSPORT_FRAME_MAX;
+		udp_msgs[i].msg_hdr.msg_iov = &udp_iovs[i];
+		udp_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	udp_count = 0;
+	udp_pos = 0;
+	t->fd = udp_fd;
+
+	INFO_MSG("listening controllers from udp port %d", port);
+	return 0;
+}
+
+static void udp_close(struct transport *t)
+{
+	if (udp_fd >= 0) {
+		close(udp_fd);
+		udp_fd = -1;
+	}
+}
+
+static int udp_recv(struct transport *t, struct frame *f)
+{
+	/* fetch next batch when previous one is consumed */
+	if (udp_pos >= udp_count) {
+		udp_pos = 0;
+		udp_count = recvmmsg(udp_fd, udp_msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (udp_count < 0) {
+			udp_count = 0;
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		} else if (udp_count == 0) {
+			return 0;
+		}
+	}
+
+	f->pipe = TRANSPORT_PIPE_NONE;
+	f->len = (uint8_t)udp_msgs[udp_pos].msg_len;
+	memcpy(f->data, udp_bufs[udp_pos], f->len);
+	udp_pos++;
+
+	return 1;
+}
+
+struct transport transport_udp = {
+	.name = "udp",
+	.open = udp_open,
+	.close = udp_close,
+	.recv = udp_recv,
+};
@@ -0,0 +1,87 @@
+/*
+ * Hashed timer wheel
+ *
+ * Timers hash into slots by expiry tick. Running a tick walks only the
+ * timers of that slot, arming and disarming are list operations.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <libe/linkedlist.h>
+#include "wheel.h"
+
+
+void wheel_init(struct wheel *wheel, uint64_t tick_ns, uint64_t now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->tick_ns = tick_ns;
+	wheel->tick = now / tick_ns;
+}
+
+void wheel_add(struct wheel *wheel, struct wheel_timer *timer, uint64_t at)
+{
+	int slot;
+
+	wheel_del(wheel, timer);
+
+	/* round up so timer never fires early, never into a tick that has already been run */
+	timer->expires = (at + wheel->tick_ns - 1) / wheel->tick_ns;
+	if (timer->expires < wheel->tick + wheel->running) {
+		timer->expires = wheel->tick + wheel->running;
+	}
+	slot = timer->expires & (WHEEL_SLOTS - 1);
+	LL_APP(wheel->first[slot], wheel->last[slot], timer);
+	timer->armed = 1;
+	wheel->armed++;
+}
+
+void wheel_del(struct wheel *wheel, struct wheel_timer *timer)
+{
+	int slot;
+
+	if (!timer->armed) {
+		return;
+	}
+	slot = timer->expires & (WHEEL_SLOTS - 1);
+	LL_RM(wheel->first[slot], wheel->last[slot], timer);
+	timer->armed = 0;
+	wheel->armed--;
+}
+
+int wheel_run(struct wheel *wheel, uint64_t now)
+{
+	uint64_t tick = now / wheel->tick_ns;
+	int expired = 0;
+
+	/* already run up to this time, also when called again with same time */
+	if (tick < wheel->tick) {
+		return 0;
+	}
+	/* after long sleep only one revolution needs to be walked */
+	if (tick - wheel->tick > WHEEL_SLOTS) {
+		wheel->tick = tick - WHEEL_SLOTS;
+	}
+
+	/* timers armed from callbacks go at earliest to next tick */
+	wheel->running = 1;
+	for (; wheel->tick <= tick; wheel->tick++) {
+		int slot = wheel->tick & (WHEEL_SLOTS - 1);
+		struct wheel_timer *timer = wheel->first[slot];
+
+		while (timer) {
+			struct wheel_timer *next = timer->next;
+			/* same slot is shared by timers from later revolutions */
+			if (timer->expires <= tick) {
+				wheel_del(wheel, timer);
+				timer->cb(timer, now);
+				expired++;
+			}
+			timer = next;
+		}
+	}
+	wheel->running = 0;
+
+	return expired;
+}
@@ -0,0 +1,79 @@
+/*
+ * Hashed timer wheel
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <stdint.h>
+
+/* must be power of two */
+#define WHEEL_SLOTS         256
+
+struct wheel_timer {
+	/* tick when timer expires */
+	uint64_t expires;
+	int armed;
+	void (*cb)(struct wheel_timer *timer, uint64_t now);
+
+	struct wheel_timer *prev;
+	struct wheel_timer *next;
+};
+
+struct wheel {
+	uint64_t tick_ns;
+	/* next tick to be processed */
+	uint64_t tick;
+	int running;
+	int armed;
+	struct wheel_timer *first[WHEEL_SLOTS];
+	struct wheel_timer *last[WHEEL_SLOTS];
+};
+
+/**
+ * Initialize wheel.
+ *
+ * @param  wheel    wheel
+ * @param  tick_ns  tick length in nanoseconds
+ * @param  now      current time in nanoseconds
+ */
+void wheel_init(struct wheel *wheel, uint64_t tick_ns, uint64_t now);
+
+/**
+ * Arm timer, rearms if already armed.
+ * Timers further than one revolution away stay in their slot until due.
+ *
+ * @param  wheel    wheel
+ * @param  timer    timer, cb must be set
+ * @param  at       expiry time in nanoseconds
+ */
+void wheel_add(struct wheel *wheel, struct wheel_timer *timer, uint64_t at);
+
+/**
+ * Disarm timer, does nothing if not armed.
+ */
+void wheel_del(struct wheel *wheel, struct wheel_timer *timer);
+
+/**
+ * Run ticks up to given time and call callbacks of expired timers.
+ * Each tick only visits its own slot, so cost does not grow with number
+ * of timers as long as they spread over the slots.
+ *
+ * @param  wheel    wheel
+ * @param  now      current time in nanoseconds
+ * @return          number of timers expired
+ */
+int wheel_run(struct wheel *wheel, uint64_t now);
+
+/**
+ * Number of armed timers.
+ */
+static inline int wheel_armed(struct wheel *wheel)
+{
+	return wheel->armed;
+}
+
+#endif /* _WHEEL_H_ */
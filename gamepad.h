@@ -4,10 +4,153 @@
 
 #include <stdint.h>
 
-struct gamepad_packet {
-	uint8_t magic[8];
-	uint16_t button;
-	uint8_t pad[22];
+/*
+ * Compact versioned wire format shared by controllers and daemon.
+ *
+ * Frame layout:
+ *  0       header: version in high nibble, flags in low nibble
+ *  1       controller id
+ *  2       sequence number
+ *  3-4     buttons, little endian
+ *  5-8     analog axes, only if GAMEPAD_FLAG_AXES is set
+ *  n       history entry count, only if GAMEPAD_FLAG_HISTORY is set
+ *  n+1...  history entries, newest first: buttons (2 bytes) and age (2 bytes),
+ *          entry k is the state that sequence number seq - 1 - k carried and age
+ *          is how long before this frame's state it was entered, in 100 us units
+ *
+ * Radio sends frames with dynamic payload length, so only used bytes
+ * are transmitted.
+ */
+
+#define GAMEPAD_VERSION         1
+#define GAMEPAD_FRAME_MAX       32
+#define GAMEPAD_AXES            4
+#define GAMEPAD_AXIS_CENTER     0x80
+#define GAMEPAD_HISTORY_MAX     4
+
+#define GAMEPAD_HDR(flags)      ((GAMEPAD_VERSION << 4) | ((flags) & 0x0f))
+#define GAMEPAD_HDR_VERSION(h)  ((h) >> 4)
+#define GAMEPAD_HDR_FLAGS(h)    ((h) & 0x0f)
+
+/* optional fields present in frame */
+#define GAMEPAD_FLAG_AXES       0x01
+#define GAMEPAD_FLAG_HISTORY    0x02
+
+#define GAMEPAD_BASE_SIZE       5
+
+/*
+ * Button bits, NES buttons occupy the low byte in the order its shift
+ * register clocks them out, SNES extras are in the high byte.
+ */
+#define GAMEPAD_BTN_A           0x0001
+#define GAMEPAD_BTN_B           0x0002
+#define GAMEPAD_BTN_SELECT      0x0004
+#define GAMEPAD_BTN_START       0x0008
+#define GAMEPAD_BTN_UP          0x0010
+#define GAMEPAD_BTN_DOWN        0x0020
+#define GAMEPAD_BTN_LEFT        0x0040
+#define GAMEPAD_BTN_RIGHT       0x0080
+#define GAMEPAD_BTN_X           0x0100
+#define GAMEPAD_BTN_Y           0x0200
+#define GAMEPAD_BTN_L           0x0400
+#define GAMEPAD_BTN_R           0x0800
+#define GAMEPAD_BUTTONS         12
+
+struct gamepad_history {
+	uint16_t buttons;
+	uint16_t age;
+};
+
+struct gamepad_state {
+	uint8_t flags;
+	uint8_t id;
+	uint8_t seq;
+	uint16_t buttons;
+	uint8_t axes[GAMEPAD_AXES];
+	uint8_t history_count;
+	struct gamepad_history history[GAMEPAD_HISTORY_MAX];
 };
 
+
+/**
+ * Encode state into frame.
+ *
+ * @param  st       state to encode
+ * @param  buf      buffer of GAMEPAD_FRAME_MAX bytes
+ * @return          frame length
+ */
+static inline int gamepad_encode(const struct gamepad_state *st, uint8_t *buf)
+{
+	int n = GAMEPAD_BASE_SIZE;
+
+	buf[0] = GAMEPAD_HDR(st->flags);
+	buf[1] = st->id;
+	buf[2] = st->seq;
+	buf[3] = st->buttons & 0xff;
+	buf[4] = st->buttons >> 8;
+	if (st->flags & GAMEPAD_FLAG_AXES) {
+		for (int i = 0; i < GAMEPAD_AXES; i++) {
+			buf[n++] = st->axes[i];
+		}
+	}
+	if (st->flags & GAMEPAD_FLAG_HISTORY) {
+		buf[n++] = st->history_count;
+		for (int i = 0; i < st->history_count; i++) {
+			buf[n++] = st->history[i].buttons & 0xff;
+			buf[n++] = st->history[i].buttons >> 8;
+			buf[n++] = st->history[i].age & 0xff;
+			buf[n++] = st->history[i].age >> 8;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Decode frame into state.
+ *
+ * @param  buf      frame
+ * @param  len      frame length
+ * @param  st       decoded state
+ * @return          0 on success, -1 if frame is invalid or of unknown version
+ */
+static inline int gamepad_decode(const uint8_t *buf, int len, struct gamepad_state *st)
+{
+	int n = GAMEPAD_BASE_SIZE;
+
+	if (len < GAMEPAD_BASE_SIZE || GAMEPAD_HDR_VERSION(buf[0]) != GAMEPAD_VERSION) {
+		return -1;
+	}
+	st->flags = GAMEPAD_HDR_FLAGS(buf[0]);
+	st->id = buf[1];
+	st->seq = buf[2];
+	st->buttons = buf[3] | (buf[4] << 8);
+	if (st->flags & GAMEPAD_FLAG_AXES) {
+		if (len < n + GAMEPAD_AXES) {
+			return -1;
+		}
+		for (int i = 0; i < GAMEPAD_AXES; i++) {
+			st->axes[i] = buf[n++];
+		}
+	} else {
+		for (int i = 0; i < GAMEPAD_AXES; i++) {
+			st->axes[i] = GAMEPAD_AXIS_CENTER;
+		}
+	}
+	st->history_count = 0;
+	if (st->flags & GAMEPAD_FLAG_HISTORY) {
+		if (len < n + 1 || buf[n] > GAMEPAD_HISTORY_MAX || len < n + 1 + buf[n] * 4) {
+			return -1;
+		}
+		st->history_count = buf[n++];
+		for (int i = 0; i < st->history_count; i++) {
+			st->history[i].buttons = buf[n] | (buf[n + 1] << 8);
+			st->history[i].age = buf[n + 2] | (buf[n + 3] << 8);
+			n += 4;
+		}
+	}
+
+	return 0;
+}
+
 #endif /* _GAMEPAD_H_ */
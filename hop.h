@@ -0,0 +1,165 @@
+/*
+ * Frequency hopping sequence shared by controller and daemon.
+ *
+ * Receiver leads: it dwells on each channel of the sequence for a fixed
+ * time and then moves to the next one that is not blacklisted. Which
+ * channels are bad is decided by receiver alone from its own loss
+ * statistics.
+ *
+ * Controllers follow through their own frames. Receiver puts its
+ * position and blacklist into acknowledgement payloads, so a frame that
+ * is acknowledged tells both where receiver is and which channels it
+ * skips. When auto-ack gives up, receiver has either moved on or the
+ * frame was lost to interference. Receiver hops once per dwell, so
+ * controller tries following channels only as far as receiver can have
+ * gone since it was last heard, then starts again from that position
+ * instead of running ahead of receiver.
+ *
+ * Both ends must be built with the same seed, it is what pairs them.
+ */
+
+#ifndef _HOP_H_
+#define _HOP_H_
+
+#include <stdint.h>
+
+/* channels in sequence, blacklist is one bit per position */
+#define HOP_CHANNELS            16
+/* candidates spread evenly from 2402 MHz to 2477 MHz */
+#define HOP_FIRST_CHANNEL       2
+#define HOP_CHANNEL_SPACING     5
+/* receiver time on each channel, controllers send keepalives more often than this */
+#define HOP_DWELL_MS            250
+/* how many following channels controller tries before giving up on a frame */
+#define HOP_TRIES               3
+
+/*
+ * Acknowledgement payload from receiver:
+ *  0       position in sequence
+ *  1-2     blacklist, little endian
+ */
+#define HOP_BEACON_SIZE         3
+
+struct hop {
+	uint8_t seq[HOP_CHANNELS];
+	uint8_t pos;
+	uint16_t blacklist;
+	/* controller side: position where receiver was last heard, when and how many hops tried past it */
+	uint8_t heard_pos;
+	uint8_t ahead;
+	uint32_t heard_ms;
+};
+
+/**
+ * Build channel sequence from seed, position is set to first channel.
+ */
+static inline void hop_init(struct hop *hop, uint32_t seed)
+{
+	/* xorshift, never zero state */
+	uint32_t x = seed ? seed : 0x9e3779b9;
+
+	for (uint8_t i = 0; i < HOP_CHANNELS; i++) {
+		hop->seq[i] = HOP_FIRST_CHANNEL + i * HOP_CHANNEL_SPACING;
+	}
+	/* shuffle, consecutive channels end up far apart with any seed worth using */
+	for (uint8_t i = HOP_CHANNELS - 1; i > 0; i--) {
+		uint8_t j, t;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		j = (uint8_t)(x % (i + 1));
+		t = hop->seq[i];
+		hop->seq[i] = hop->seq[j];
+		hop->seq[j] = t;
+	}
+	hop->pos = 0;
+	hop->blacklist = 0;
+	hop->heard_pos = 0;
+	hop->ahead = 0;
+	hop->heard_ms = 0;
+}
+
+/**
+ * Channel at current position.
+ */
+static inline uint8_t hop_channel(const struct hop *hop)
+{
+	return hop->seq[hop->pos];
+}
+
+/**
+ * Move to next position that is not blacklisted.
+ * If everything is blacklisted, position comes back where it was.
+ *
+ * @return          new channel
+ */
+static inline uint8_t hop_next(struct hop *hop)
+{
+	for (uint8_t i = 0; i < HOP_CHANNELS; i++) {
+		hop->pos = (hop->pos + 1) % HOP_CHANNELS;
+		if (!(hop->blacklist & (1u << hop->pos))) {
+			break;
+		}
+	}
+	return hop->seq[hop->pos];
+}
+
+/**
+ * Encode receiver position and blacklist for acknowledgement payload.
+ *
+ * @param  buf      buffer of HOP_BEACON_SIZE bytes
+ * @return          payload length
+ */
+static inline int hop_beacon(const struct hop *hop, uint8_t *buf)
+{
+	buf[0] = hop->pos;
+	buf[1] = hop->blacklist & 0xff;
+	buf[2] = hop->blacklist >> 8;
+	return HOP_BEACON_SIZE;
+}
+
+/**
+ * Controller frame was acknowledged, receiver is on current channel.
+ * Beacon that does not match current channel was queued before receiver
+ * hopped here, its blacklist is still taken but position is not.
+ *
+ * @param  ack      acknowledgement payload, NULL if there was none
+ * @param  len      payload length
+ * @param  now_ms   controller time in milliseconds
+ */
+static inline void hop_heard(struct hop *hop, const uint8_t *ack, int len, uint32_t now_ms)
+{
+	if (ack && len == HOP_BEACON_SIZE && ack[0] < HOP_CHANNELS) {
+		hop->blacklist = ack[1] | (ack[2] << 8);
+		if (hop->seq[ack[0]] == hop->seq[hop->pos]) {
+			hop->pos = ack[0];
+		}
+	}
+	hop->heard_pos = hop->pos;
+	hop->ahead = 0;
+	hop->heard_ms = now_ms;
+}
+
+/**
+ * Controller frame was not acknowledged, move to channel to try next.
+ * Receiver can not be further than one hop per dwell since last heard,
+ * plus one for a hop right after it. When all of those are tried, frame
+ * was lost to interference and search starts again from last position.
+ *
+ * @param  now_ms   controller time in milliseconds
+ * @return          new channel
+ */
+static inline uint8_t hop_missed(struct hop *hop, uint32_t now_ms)
+{
+	uint32_t reach = (now_ms - hop->heard_ms) / HOP_DWELL_MS + 1;
+
+	if (hop->ahead < reach && hop->ahead < HOP_CHANNELS) {
+		hop->ahead++;
+		return hop_next(hop);
+	}
+	hop->pos = hop->heard_pos;
+	hop->ahead = 0;
+	return hop_channel(hop);
+}
+
+#endif /* _HOP_H_ */
@@ -0,0 +1,5 @@
+#
+# Controller input readers shared by controller and bluetooth firmware.
+#
+
+COMPONENT_ADD_INCLUDEDIRS := .
@@ -0,0 +1,304 @@
+/*
+ * NES/SNES controller shift register (4021) reader
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <time.h>
+#include "nes.h"
+#include "../gamepad.h"
+
+#ifdef TARGET_ESP32
+#include <esp_timer.h>
+#endif
+#if defined(TARGET_ESP32) && !defined(NES_SIM)
+#include <driver/gpio.h>
+#include <driver/spi_master.h>
+#include <rom/ets_sys.h>
+#elif !defined(NES_SIM)
+#include <libe/os.h>
+#endif
+
+static struct nes_scan_stats scan_stats = { .us_min = UINT32_MAX };
+
+
+#if defined(TARGET_ESP32) && !defined(NES_SIM)
+
+/*
+ * SPI mode 2: clock idles high like on the original console, data is
+ * sampled on falling edge and the 4021 shifts on rising edge, so there
+ * is half a clock of margin on both sides. At 2 MHz a 17 bit scan takes
+ * 8.5 us and is done completely by the peripheral.
+ */
+#define NES_SPI_HOST        VSPI_HOST
+#define NES_SPI_HZ          2000000
+
+static spi_device_handle_t nes_spi = NULL;
+static int nes_latch = -1;
+
+int nes_open(int clock, int latch, int data)
+{
+	spi_bus_config_t bus;
+	spi_device_interface_config_t dev;
+
+	memset(&bus, 0, sizeof(bus));
+	bus.miso_io_num = data;
+	bus.mosi_io_num = -1;
+	bus.sclk_io_num = clock;
+	bus.quadwp_io_num = -1;
+	bus.quadhd_io_num = -1;
+	bus.max_transfer_sz = 4;
+	if (spi_bus_initialize(NES_SPI_HOST, &bus, 0) != ESP_OK) {
+		return -1;
+	}
+
+	memset(&dev, 0, sizeof(dev));
+	dev.mode = 2;
+	dev.clock_speed_hz = NES_SPI_HZ;
+	dev.spics_io_num = -1;
+	dev.queue_size = 1;
+	dev.flags = SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_RXBIT_LSBFIRST;
+	if (spi_bus_add_device(NES_SPI_HOST, &dev, &nes_spi) != ESP_OK) {
+		spi_bus_free(NES_SPI_HOST);
+		return -1;
+	}
+
+	/* data line is open collector in controller */
+	gpio_set_pull_mode(data, GPIO_PULLUP_ONLY);
+	nes_latch = latch;
+	gpio_reset_pin(latch);
+	gpio_set_direction(latch, GPIO_MODE_OUTPUT);
+	gpio_set_level(latch, 0);
+
+	return 0;
+}
+
+void nes_close(void)
+{
+	if (nes_spi) {
+		spi_bus_remove_device(nes_spi);
+		spi_bus_free(NES_SPI_HOST);
+		nes_spi = NULL;
+	}
+}
+
+uint32_t nes_read(int bits)
+{
+	spi_transaction_t t;
+
+	/* 4021 needs only a short latch pulse to load parallel inputs */
+	gpio_set_level(nes_latch, 1);
+	ets_delay_us(1);
+	gpio_set_level(nes_latch, 0);
+
+	memset(&t, 0, sizeof(t));
+	t.flags = SPI_TRANS_USE_RXDATA;
+	t.rxlength = bits;
+	if (spi_device_polling_transmit(nes_spi, &t) != ESP_OK) {
+		return 0;
+	}
+
+	/* data is active low */
+	return ~(t.rx_data[0] | (t.rx_data[1] << 8) | ((uint32_t)t.rx_data[2] << 16)) & ((1UL << bits) - 1);
+}
+
+#else
+
+#ifdef NES_SIM
+
+static uint16_t sim_pressed = 0;
+static int sim_bits = 16;
+static uint16_t sim_reg = 0;
+static int sim_clock = 1;
+static struct nes_sim_stats sim_stats;
+
+#define NES_GPIO_OUTPUT(pin)
+#define NES_GPIO_INPUT(pin)
+#define NES_DELAY_US(us)
+
+static void nes_gpio_set(int pin, int level);
+static int nes_gpio_read(int pin);
+#define NES_GPIO_HIGH(pin)  nes_gpio_set(pin, 1)
+#define NES_GPIO_LOW(pin)   nes_gpio_set(pin, 0)
+#define NES_GPIO_READ(pin)  nes_gpio_read(pin)
+
+#else
+
+#define NES_GPIO_OUTPUT(pin) os_gpio_output(pin)
+#define NES_GPIO_INPUT(pin) os_gpio_input(pin)
+#define NES_GPIO_HIGH(pin)  os_gpio_high(pin)
+#define NES_GPIO_LOW(pin)   os_gpio_low(pin)
+#define NES_GPIO_READ(pin)  os_gpio_read(pin)
+/* 4021 is fast, delays are only needed for slow level shifters and cabling */
+#define NES_DELAY_US(us)    os_delay_us(us)
+
+#endif
+
+static int nes_clock = -1;
+static int nes_latch = -1;
+static int nes_data = -1;
+
+int nes_open(int clock, int latch, int data)
+{
+	nes_clock = clock;
+	nes_latch = latch;
+	nes_data = data;
+	NES_GPIO_OUTPUT(clock);
+	NES_GPIO_HIGH(clock);
+	NES_GPIO_OUTPUT(latch);
+	NES_GPIO_LOW(latch);
+	NES_GPIO_INPUT(data);
+	return 0;
+}
+
+void nes_close(void)
+{
+}
+
+uint32_t nes_read(int bits)
+{
+	uint32_t b = 0;
+
+	/* latch pulse loads button states, first one is then readable */
+	NES_GPIO_HIGH(nes_latch);
+	NES_DELAY_US(1);
+	NES_GPIO_LOW(nes_latch);
+
+	/* clock idles high, read while low and shift on rising edge */
+	for (int i = 0; i < bits; i++) {
+		NES_GPIO_LOW(nes_clock);
+		NES_DELAY_US(1);
+		b |= (uint32_t)(NES_GPIO_READ(nes_data) ? 0 : 1) << i;
+		NES_GPIO_HIGH(nes_clock);
+		NES_DELAY_US(1);
+	}
+
+	return b;
+}
+
+#ifdef NES_SIM
+
+static void nes_gpio_set(int pin, int level)
+{
+	if (pin == nes_latch && level) {
+		/* parallel load, data is active low and ground is shifted in after last bit */
+		sim_reg = ~sim_pressed & ((1 << sim_bits) - 1);
+		sim_stats.latches++;
+	} else if (pin == nes_clock) {
+		if (level && !sim_clock) {
+			/* shift on rising edge, serial input of last 4021 is tied to ground */
+			sim_reg >>= 1;
+			sim_stats.clocks++;
+		}
+		sim_clock = level;
+	}
+}
+
+static int nes_gpio_read(int pin)
+{
+	sim_stats.reads++;
+	if (sim_clock) {
+		sim_stats.reads_clock_high++;
+	}
+	/* nothing connected, pull-up keeps data high */
+	if (sim_bits < 1) {
+		return 1;
+	}
+	return sim_reg & 1;
+}
+
+void nes_sim_set(uint16_t pressed, int bits)
+{
+	sim_pressed = pressed;
+	sim_bits = bits;
+}
+
+void nes_sim_stats(struct nes_sim_stats *stats)
+{
+	*stats = sim_stats;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+#endif
+
+#endif
+
+
+/* monotonic time in microseconds */
+static uint32_t nes_time_us(void)
+{
+#ifdef TARGET_ESP32
+	return (uint32_t)esp_timer_get_time();
+#elif defined(TARGET_X86) || defined(TARGET_RPI) || defined(NES_SIM)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#else
+	/* no clock, statistics show zero */
+	return 0;
+#endif
+}
+
+/* snes order is B, Y, select, start, up, down, left, right, A, X, L, R */
+static uint16_t nes_snes_buttons(uint16_t b)
+{
+	uint16_t buttons = b & 0x00fc;
+
+	buttons |= b & 0x0001 ? GAMEPAD_BTN_B : 0;
+	buttons |= b & 0x0002 ? GAMEPAD_BTN_Y : 0;
+	buttons |= b & 0x0100 ? GAMEPAD_BTN_A : 0;
+	buttons |= b & 0x0200 ? GAMEPAD_BTN_X : 0;
+	buttons |= b & 0x0400 ? GAMEPAD_BTN_L : 0;
+	buttons |= b & 0x0800 ? GAMEPAD_BTN_R : 0;
+
+	return buttons;
+}
+
+int nes_scan(uint16_t *buttons)
+{
+	uint32_t t, us, b;
+	int type;
+
+	t = nes_time_us();
+	b = nes_read(NES_SCAN_BITS);
+	us = nes_time_us() - t;
+
+	scan_stats.count++;
+	scan_stats.us_total += us;
+	if (us < scan_stats.us_min) {
+		scan_stats.us_min = us;
+	}
+	if (us > scan_stats.us_max) {
+		scan_stats.us_max = us;
+	}
+
+	if (!(b & 0x10000)) {
+		/* nothing shifted in ground after register, data line is only pulled up */
+		*buttons = 0;
+		type = NES_TYPE_NONE;
+	} else if ((b & 0xff00) == 0xff00) {
+		/* nes order is already the gamepad layout */
+		*buttons = b & 0x00ff;
+		type = NES_TYPE_NES;
+	} else if ((b & 0xf000) == 0) {
+		*buttons = nes_snes_buttons((uint16_t)b);
+		type = NES_TYPE_SNES;
+	} else {
+		*buttons = 0;
+		type = NES_TYPE_NONE;
+	}
+
+	return type;
+}
+
+void nes_scan_stats(struct nes_scan_stats *stats)
+{
+	*stats = scan_stats;
+	if (stats->count < 1) {
+		stats->us_min = 0;
+	}
+	memset(&scan_stats, 0, sizeof(scan_stats));
+	scan_stats.us_min = UINT32_MAX;
+}
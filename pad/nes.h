@@ -0,0 +1,117 @@
+/*
+ * NES/SNES controller shift register (4021) reader
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _NES_H_
+#define _NES_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* controller types recognized by nes_scan() */
+#define NES_TYPE_NONE       0
+#define NES_TYPE_NES        1
+#define NES_TYPE_SNES       2
+
+/* scan time statistics */
+struct nes_scan_stats {
+	/* scans done */
+	uint32_t count;
+	/* scan durations in microseconds */
+	uint32_t us_min;
+	uint32_t us_max;
+	uint64_t us_total;
+};
+
+/*
+ * Backends:
+ *  - ESP32: SPI peripheral clocks the register, only latch pulse is done by cpu
+ *  - NES_SIM: simulated shift register for host builds
+ *  - others: bit-banged gpio through libe
+ */
+
+/**
+ * Open reader.
+ *
+ * @param  clock    clock gpio
+ * @param  latch    latch gpio
+ * @param  data     data gpio
+ * @return          0 on success, -1 on errors
+ */
+int nes_open(int clock, int latch, int data);
+
+/**
+ * Close reader.
+ */
+void nes_close(void);
+
+/* bits clocked out by nes_scan(), one past SNES register tells if anything is connected */
+#define NES_SCAN_BITS       17
+
+/**
+ * Read controller.
+ *
+ * @param  bits     number of bits to clock out, 8 for NES and 16 for SNES, at most 24
+ * @return          button bits, first bit clocked out is bit 0, 1 means pressed
+ */
+uint32_t nes_read(int bits);
+
+/**
+ * Read controller and detect its type.
+ *
+ * NES_SCAN_BITS are always clocked out. NES has only 8 bits and after them
+ * the register shifts in ground, which reads as all buttons pressed. SNES
+ * has 12 buttons and its last 4 bits are always high, so released, and
+ * after its 16 bits ground is shifted in too. Without a controller data
+ * line is only pulled up and every bit reads released, which an idle SNES
+ * also does for its 16 bits, so the bit after them tells these apart.
+ * This way controllers can be swapped and unplugged while running.
+ *
+ * @param  buttons  buttons in gamepad.h GAMEPAD_BTN_* layout
+ * @return          NES_TYPE_*
+ */
+int nes_scan(uint16_t *buttons);
+
+/**
+ * Get and reset scan time statistics.
+ */
+void nes_scan_stats(struct nes_scan_stats *stats);
+
+#ifdef NES_SIM
+/* simulated shift register for testing timing and bit order */
+struct nes_sim_stats {
+	/* latch pulses */
+	int latches;
+	/* rising clock edges */
+	int clocks;
+	/* data line reads */
+	int reads;
+	/* reads that happened while clock was high */
+	int reads_clock_high;
+};
+
+/**
+ * Set buttons pressed in simulated controller, bit 0 is shifted out first.
+ *
+ * @param  pressed  pressed buttons
+ * @param  bits     register length, 8 for NES and 16 for SNES, 0 for no controller
+ */
+void nes_sim_set(uint16_t pressed, int bits);
+
+/**
+ * Get and reset simulation statistics.
+ */
+void nes_sim_stats(struct nes_sim_stats *stats);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NES_H_ */
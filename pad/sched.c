@@ -0,0 +1,249 @@
+/*
+ * Fixed rate controller sampling scheduler
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "sched.h"
+
+#if defined(TARGET_ESP32)
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#define SCHED_CLOCK
+#elif defined(TARGET_X86) || defined(TARGET_RPI) || defined(NES_SIM)
+#define SCHED_CLOCK
+#else
+#include <libe/os.h>
+#endif
+
+
+static uint32_t sched_period = 0;
+static struct sched_stats stats;
+
+
+#ifdef SCHED_CLOCK
+
+/* when next tick is due */
+static uint64_t sched_next = 0;
+/* when current tick woke up, 0 before first tick */
+static uint64_t sched_woke = 0;
+
+static uint64_t sched_time_us(void)
+{
+#ifdef TARGET_ESP32
+	return (uint64_t)esp_timer_get_time();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void sched_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.jitter_min = UINT32_MAX;
+	stats.busy_min = UINT32_MAX;
+}
+
+/* work done since previous tick woke up */
+static void sched_busy_end(void)
+{
+	uint32_t busy;
+
+	if (!sched_woke) {
+		return;
+	}
+	busy = (uint32_t)(sched_time_us() - sched_woke);
+	stats.busy_total += busy;
+	if (busy < stats.busy_min) {
+		stats.busy_min = busy;
+	}
+	if (busy > stats.busy_max) {
+		stats.busy_max = busy;
+	}
+}
+
+static void sched_tick(uint64_t due, int missed)
+{
+	uint32_t jitter;
+
+	sched_woke = sched_time_us();
+	jitter = sched_woke > due ? (uint32_t)(sched_woke - due) : 0;
+	stats.ticks++;
+	stats.missed += missed;
+	stats.jitter_total += jitter;
+	if (jitter < stats.jitter_min) {
+		stats.jitter_min = jitter;
+	}
+	if (jitter > stats.jitter_max) {
+		stats.jitter_max = jitter;
+	}
+}
+
+#endif
+
+
+#if defined(TARGET_ESP32)
+
+static esp_timer_handle_t sched_timer = NULL;
+
+static void sched_timer_cb(void *arg)
+{
+	xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+int sched_start(int hz)
+{
+	esp_timer_create_args_t args;
+
+	if (hz < SCHED_HZ_MIN || hz > SCHED_HZ_MAX) {
+		return -1;
+	}
+	sched_period = 1000000 / hz;
+	sched_stats_reset();
+
+	/* timer task wakes the task that started the scheduler */
+	memset(&args, 0, sizeof(args));
+	args.callback = sched_timer_cb;
+	args.arg = xTaskGetCurrentTaskHandle();
+	args.dispatch_method = ESP_TIMER_TASK;
+	args.name = "sched";
+	if (esp_timer_create(&args, &sched_timer) != ESP_OK) {
+		return -1;
+	}
+	ulTaskNotifyTake(pdTRUE, 0);
+	sched_woke = 0;
+	sched_next = sched_time_us() + sched_period;
+	if (esp_timer_start_periodic(sched_timer, sched_period) != ESP_OK) {
+		esp_timer_delete(sched_timer);
+		sched_timer = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void sched_stop(void)
+{
+	if (sched_timer) {
+		esp_timer_stop(sched_timer);
+		esp_timer_delete(sched_timer);
+		sched_timer = NULL;
+	}
+}
+
+int sched_wait(void)
+{
+	uint32_t n;
+	uint64_t due;
+
+	sched_busy_end();
+
+	/* notifications pile up if previous tick overran */
+	n = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	if (n < 1) {
+		n = 1;
+	}
+	due = sched_next + (uint64_t)(n - 1) * sched_period;
+	sched_next = due + sched_period;
+	sched_tick(due, n - 1);
+
+	return n - 1;
+}
+
+#elif defined(SCHED_CLOCK)
+
+int sched_start(int hz)
+{
+	if (hz < SCHED_HZ_MIN || hz > SCHED_HZ_MAX) {
+		return -1;
+	}
+	sched_period = 1000000 / hz;
+	sched_stats_reset();
+	sched_woke = 0;
+	sched_next = sched_time_us() + sched_period;
+
+	return 0;
+}
+
+void sched_stop(void)
+{
+}
+
+int sched_wait(void)
+{
+	struct timespec ts;
+	uint64_t now;
+	int missed = 0;
+
+	sched_busy_end();
+
+	/* skip ticks that are already over instead of bursting to catch up */
+	now = sched_time_us();
+	if (now >= sched_next + sched_period) {
+		missed = (int)((now - sched_next) / sched_period);
+		sched_next += (uint64_t)missed * sched_period;
+	}
+
+	/* absolute wake up time does not drift with loop run time */
+	ts.tv_sec = sched_next / 1000000;
+	ts.tv_nsec = (sched_next % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	sched_tick(sched_next, missed);
+	sched_next += sched_period;
+
+	return missed;
+}
+
+#else
+
+int sched_start(int hz)
+{
+	if (hz < SCHED_HZ_MIN || hz > SCHED_HZ_MAX) {
+		return -1;
+	}
+	sched_period = 1000000 / hz;
+	memset(&stats, 0, sizeof(stats));
+
+	return 0;
+}
+
+void sched_stop(void)
+{
+}
+
+int sched_wait(void)
+{
+	/* no clock, delay of one period keeps rate roughly right */
+	os_delay_us(sched_period);
+	stats.ticks++;
+
+	return 0;
+}
+
+#endif
+
+
+void sched_stats(struct sched_stats *s)
+{
+	*s = stats;
+	/* nothing measured yet */
+	if (s->jitter_min == UINT32_MAX) {
+		s->jitter_min = 0;
+	}
+	if (s->busy_min == UINT32_MAX) {
+		s->busy_min = 0;
+	}
+#ifdef SCHED_CLOCK
+	sched_stats_reset();
+#else
+	memset(&stats, 0, sizeof(stats));
+#endif
+}
@@ -0,0 +1,72 @@
+/*
+ * Fixed rate controller sampling scheduler
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Backends:
+ *  - ESP32: esp_timer periodic timer notifies waiting task
+ *  - x86/RPi and NES_SIM: clock_nanosleep() to absolute tick times
+ *  - others: plain delay of one period, no statistics
+ */
+
+#define SCHED_HZ_MIN        125
+#define SCHED_HZ_MAX        2000
+
+/* statistics since last call to sched_stats(), times in microseconds */
+struct sched_stats {
+	/* ticks run */
+	uint32_t ticks;
+	/* ticks that were skipped because previous one ran too long */
+	uint32_t missed;
+	/* how late from its scheduled time each tick woke up */
+	uint32_t jitter_min;
+	uint32_t jitter_max;
+	uint64_t jitter_total;
+	/* time from wake up to next sched_wait(), scan and send */
+	uint32_t busy_min;
+	uint32_t busy_max;
+	uint64_t busy_total;
+};
+
+/**
+ * Start scheduler.
+ *
+ * @param  hz       tick rate, from SCHED_HZ_MIN to SCHED_HZ_MAX
+ * @return          0 on success, -1 on errors
+ */
+int sched_start(int hz);
+
+/**
+ * Stop scheduler.
+ */
+void sched_stop(void);
+
+/**
+ * Wait for next tick.
+ *
+ * @return          ticks missed since previous wait, 0 when on time
+ */
+int sched_wait(void);
+
+/**
+ * Get and reset statistics.
+ */
+void sched_stats(struct sched_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SCHED_H_ */
@@ -0,0 +1,314 @@
+/*
+ * nRF24L01+ register level helpers shared by controller and daemon.
+ *
+ * libe nrf driver handles basic setup, these add multiple rx pipes
+ * and pipe aware receive on top of it.
+ */
+
+#ifndef _RADIO_H_
+#define _RADIO_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <libe/os.h>
+#include <libe/drivers/spi/nrf.h>
+
+#define RADIO_PIPES             6
+#define RADIO_PAYLOAD_SIZE      32
+/* defaults, receiver and controllers must agree */
+#define RADIO_CHANNEL           17
+#define RADIO_DATA_RATE         2000
+
+/* commands */
+#define RADIO_CMD_R_REGISTER    0x00
+#define RADIO_CMD_W_REGISTER    0x20
+#define RADIO_CMD_R_RX_PAYLOAD  0x61
+#define RADIO_CMD_W_TX_PAYLOAD  0xa0
+#define RADIO_CMD_FLUSH_TX      0xe1
+#define RADIO_CMD_FLUSH_RX      0xe2
+#define RADIO_CMD_R_RX_PL_WID   0x60
+#define RADIO_CMD_W_ACK_PAYLOAD 0xa8
+#define RADIO_CMD_NOP           0xff
+
+/* registers */
+#define RADIO_REG_EN_AA         0x01
+#define RADIO_REG_EN_RXADDR     0x02
+#define RADIO_REG_SETUP_AW      0x03
+#define RADIO_REG_RF_SETUP      0x06
+#define RADIO_REG_STATUS        0x07
+#define RADIO_REG_FIFO_STATUS   0x17
+#define RADIO_REG_RX_ADDR_P0    0x0a
+#define RADIO_REG_TX_ADDR       0x10
+#define RADIO_REG_RX_PW_P0      0x11
+#define RADIO_REG_DYNPD         0x1c
+#define RADIO_REG_FEATURE       0x1d
+
+#define RADIO_FEATURE_EN_DPL    0x04
+#define RADIO_FEATURE_EN_ACK_PAY 0x02
+#define RADIO_FIFO_TX_FULL      0x20
+
+#define RADIO_RF_DR_LOW         0x20
+#define RADIO_RF_DR_HIGH        0x08
+
+/* always reads as zero, set when nothing answers on spi */
+#define RADIO_STATUS_RESERVED   0x80
+#define RADIO_STATUS_RX_DR      0x40
+#define RADIO_STATUS_TX_DS      0x20
+#define RADIO_STATUS_MAX_RT     0x10
+#define RADIO_STATUS_RX_P_NO(s) (((s) >> 1) & 0x07)
+#define RADIO_RX_P_EMPTY        0x07
+
+
+static inline uint8_t radio_reg_write(struct nrf_device *nrf, uint8_t reg, const uint8_t *data, uint8_t len)
+{
+	uint8_t buf[1 + 5];
+	buf[0] = RADIO_CMD_W_REGISTER | reg;
+	memcpy(buf + 1, data, len);
+	spi_transfer(&nrf->spi, buf, 1 + len);
+	return buf[0];
+}
+
+static inline uint8_t radio_reg_write_byte(struct nrf_device *nrf, uint8_t reg, uint8_t value)
+{
+	return radio_reg_write(nrf, reg, &value, 1);
+}
+
+static inline uint8_t radio_status(struct nrf_device *nrf)
+{
+	uint8_t buf = RADIO_CMD_NOP;
+	spi_transfer(&nrf->spi, &buf, 1);
+	return buf;
+}
+
+static inline uint8_t radio_reg_read_byte(struct nrf_device *nrf, uint8_t reg)
+{
+	uint8_t buf[2] = { RADIO_CMD_R_REGISTER | reg, RADIO_CMD_NOP };
+	spi_transfer(&nrf->spi, buf, 2);
+	return buf[1];
+}
+
+/**
+ * Set air data rate, output power bits are kept.
+ *
+ * @param  nrf      device
+ * @param  kbps     250, 1000 or 2000
+ */
+static inline void radio_data_rate(struct nrf_device *nrf, int kbps)
+{
+	uint8_t rf = radio_reg_read_byte(nrf, RADIO_REG_RF_SETUP) & ~(RADIO_RF_DR_LOW | RADIO_RF_DR_HIGH);
+
+	if (kbps == 250) {
+		rf |= RADIO_RF_DR_LOW;
+	} else if (kbps == 2000) {
+		rf |= RADIO_RF_DR_HIGH;
+	}
+	radio_reg_write_byte(nrf, RADIO_REG_RF_SETUP, rf);
+}
+
+/**
+ * Address of given pipe, least significant byte first.
+ * Pipes 1-5 must share the four upper bytes, only first byte differs.
+ */
+static inline void radio_pipe_address(uint8_t pipe, uint8_t addr[5])
+{
+	addr[0] = 0xc0 + pipe;
+	addr[1] = 'g';
+	addr[2] = 'a';
+	addr[3] = 'm';
+	addr[4] = 'e';
+}
+
+static inline uint8_t radio_command(struct nrf_device *nrf, uint8_t cmd, uint8_t *arg)
+{
+	uint8_t buf[2] = { cmd, RADIO_CMD_NOP };
+	spi_transfer(&nrf->spi, buf, arg ? 2 : 1);
+	if (arg) {
+		*arg = buf[1];
+	}
+	return buf[0];
+}
+
+/**
+ * Enable dynamic payload length on pipes in mask.
+ * Acknowledgements can then carry payloads too, without one they stay empty.
+ */
+static inline void radio_dynamic_payload(struct nrf_device *nrf, uint8_t mask)
+{
+	radio_reg_write_byte(nrf, RADIO_REG_FEATURE, RADIO_FEATURE_EN_DPL | RADIO_FEATURE_EN_ACK_PAY);
+	radio_reg_write_byte(nrf, RADIO_REG_DYNPD, mask);
+}
+
+/**
+ * Setup receiver to listen given number of pipes with auto-ack.
+ */
+static inline void radio_rx_pipes(struct nrf_device *nrf, uint8_t count)
+{
+	uint8_t addr[5], mask = (1 << count) - 1;
+
+	/* five byte addresses */
+	radio_reg_write_byte(nrf, RADIO_REG_SETUP_AW, 0x03);
+	for (uint8_t pipe = 0; pipe < count; pipe++) {
+		radio_pipe_address(pipe, addr);
+		/* pipes 0 and 1 take full address, rest only first byte */
+		radio_reg_write(nrf, RADIO_REG_RX_ADDR_P0 + pipe, addr, pipe < 2 ? 5 : 1);
+		radio_reg_write_byte(nrf, RADIO_REG_RX_PW_P0 + pipe, RADIO_PAYLOAD_SIZE);
+	}
+	radio_reg_write_byte(nrf, RADIO_REG_EN_RXADDR, mask);
+	radio_reg_write_byte(nrf, RADIO_REG_EN_AA, mask);
+	radio_dynamic_payload(nrf, mask);
+}
+
+/**
+ * Setup transmitter to send into given pipe of the receiver.
+ * Pipe 0 receive address must match for auto-ack to work.
+ */
+static inline void radio_tx_pipe(struct nrf_device *nrf, uint8_t pipe)
+{
+	uint8_t addr[5];
+	radio_pipe_address(pipe, addr);
+	radio_reg_write_byte(nrf, RADIO_REG_SETUP_AW, 0x03);
+	radio_reg_write(nrf, RADIO_REG_TX_ADDR, addr, 5);
+	radio_reg_write(nrf, RADIO_REG_RX_ADDR_P0, addr, 5);
+	radio_reg_write_byte(nrf, RADIO_REG_EN_RXADDR, 0x01);
+	radio_reg_write_byte(nrf, RADIO_REG_EN_AA, 0x01);
+	radio_dynamic_payload(nrf, 0x01);
+}
+
+/**
+ * Send payload of given length, radio must be in tx mode.
+ * Does not wait for result, with auto-ack radio_send_wait() must be used
+ * because radio stops sending until failed status is cleared.
+ */
+static inline void radio_send(struct nrf_device *nrf, const void *data, uint8_t len)
+{
+	uint8_t buf[1 + RADIO_PAYLOAD_SIZE];
+
+	buf[0] = RADIO_CMD_W_TX_PAYLOAD;
+	memcpy(buf + 1, data, len);
+	spi_transfer(&nrf->spi, buf, 1 + len);
+
+	/* ce pulse of at least 10 us starts transmission */
+	os_gpio_high(nrf->ce);
+	os_delay_us(10);
+	os_gpio_low(nrf->ce);
+}
+
+/**
+ * Queue payload for receiver to send with next acknowledgement on pipe.
+ * Receiver tx fifo holds three, payload is dropped when it is full.
+ *
+ * @return          0 when queued, -1 if fifo was full
+ */
+static inline int radio_ack_payload(struct nrf_device *nrf, uint8_t pipe, const void *data, uint8_t len)
+{
+	uint8_t buf[1 + RADIO_PAYLOAD_SIZE];
+
+	if (radio_reg_read_byte(nrf, RADIO_REG_FIFO_STATUS) & RADIO_FIFO_TX_FULL) {
+		return -1;
+	}
+	buf[0] = RADIO_CMD_W_ACK_PAYLOAD | pipe;
+	memcpy(buf + 1, data, len);
+	spi_transfer(&nrf->spi, buf, 1 + len);
+	return 0;
+}
+
+/**
+ * Drop acknowledgement payloads receiver has queued.
+ */
+static inline void radio_ack_flush(struct nrf_device *nrf)
+{
+	radio_command(nrf, RADIO_CMD_FLUSH_TX, NULL);
+}
+
+/**
+ * Receive one payload from rx fifo.
+ *
+ * @param  nrf      device
+ * @param  data     buffer of RADIO_PAYLOAD_SIZE bytes
+ * @param  pipe     pipe number the payload arrived to
+ * @param  dynamic  payloads have dynamic length
+ * @return          payload size, 0 if fifo is empty, -1 if radio does not answer
+ */
+static inline int radio_recv(struct nrf_device *nrf, void *data, uint8_t *pipe, int dynamic)
+{
+	uint8_t buf[1 + RADIO_PAYLOAD_SIZE];
+	uint8_t status = radio_status(nrf);
+	uint8_t len = RADIO_PAYLOAD_SIZE;
+
+	if (status & RADIO_STATUS_RESERVED) {
+		return -1;
+	}
+	if (RADIO_STATUS_RX_P_NO(status) == RADIO_RX_P_EMPTY) {
+		return 0;
+	}
+	*pipe = RADIO_STATUS_RX_P_NO(status);
+
+	/* read only bytes that were sent, corrupted width means fifo must be flushed */
+	if (dynamic) {
+		radio_command(nrf, RADIO_CMD_R_RX_PL_WID, &len);
+		if (len < 1 || len > RADIO_PAYLOAD_SIZE) {
+			radio_command(nrf, RADIO_CMD_FLUSH_RX, NULL);
+			radio_reg_write_byte(nrf, RADIO_REG_STATUS, RADIO_STATUS_RX_DR);
+			return 0;
+		}
+	}
+
+	memset(buf, RADIO_CMD_NOP, sizeof(buf));
+	buf[0] = RADIO_CMD_R_RX_PAYLOAD;
+	spi_transfer(&nrf->spi, buf, 1 + len);
+	memcpy(data, buf + 1, len);
+
+	/* clear data ready, irq line is released when fifo is empty */
+	radio_reg_write_byte(nrf, RADIO_REG_STATUS, RADIO_STATUS_RX_DR);
+
+	return len;
+}
+
+/* auto-ack retransmits end well before this, in 10 us polls */
+#define RADIO_SEND_WAIT_POLLS   1000
+
+/**
+ * Send payload and wait until receiver acknowledges it or auto-ack gives up.
+ * Radio must be in tx mode with auto-ack enabled.
+ *
+ * @param  ack      buffer of RADIO_PAYLOAD_SIZE bytes for acknowledgement payload, NULL to drop it
+ * @return          acknowledgement payload length, 0 if there was none, -1 if not acknowledged
+ */
+static inline int radio_send_wait_ack(struct nrf_device *nrf, const void *data, uint8_t len, void *ack)
+{
+	uint8_t status = 0, pipe, buf[RADIO_PAYLOAD_SIZE];
+	int n;
+
+	radio_send(nrf, data, len);
+	for (int i = 0; i < RADIO_SEND_WAIT_POLLS; i++) {
+		status = radio_status(nrf);
+		if (status & (RADIO_STATUS_TX_DS | RADIO_STATUS_MAX_RT)) {
+			break;
+		}
+		os_delay_us(10);
+	}
+	radio_reg_write_byte(nrf, RADIO_REG_STATUS, RADIO_STATUS_TX_DS | RADIO_STATUS_MAX_RT);
+
+	/* failed payload stays in fifo until flushed */
+	if (!(status & RADIO_STATUS_TX_DS)) {
+		radio_command(nrf, RADIO_CMD_FLUSH_TX, NULL);
+		return -1;
+	}
+
+	/* payload that came with acknowledgement is in rx fifo, it must not pile up there */
+	n = radio_recv(nrf, ack ? ack : buf, &pipe, 1);
+	return n > 0 ? n : 0;
+}
+
+/**
+ * Send payload and wait until receiver acknowledges it or auto-ack gives up.
+ * Radio must be in tx mode with auto-ack enabled.
+ *
+ * @return          0 when acknowledged, -1 if not
+ */
+static inline int radio_send_wait(struct nrf_device *nrf, const void *data, uint8_t len)
+{
+	return radio_send_wait_ack(nrf, data, len, NULL) < 0 ? -1 : 0;
+}
+
+#endif /* _RADIO_H_ */
@@ -0,0 +1,33 @@
+/*
+ * Checks for host built tests
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+/* print failed condition with formatted details and keep going */
+#define CHECK(cond, ...) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: %s failed: ", __FILE__, __LINE__, #cond); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			test_failures++; \
+		} \
+	} while (0)
+
+/* report and give exit code */
+static inline int test_result(const char *name)
+{
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+	return test_failures ? 1 : 0;
+}
+
+#endif /* _TEST_H_ */
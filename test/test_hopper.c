@@ -0,0 +1,135 @@
+/*
+ * Frequency hopping against simulated interference
+ *
+ * Generated frames are lost on a range of channels. Receiver side runs
+ * as in daemon, in virtual time of one millisecond per generated frame
+ * so that minutes of hopping take well under a second. Simulated
+ * controller follows receiver from acknowledgement payloads with same
+ * logic as real ones. Lossy channels must be left out of the sequence
+ * after first evaluation and be tried again when their parole is over,
+ * and controller must not lose receiver for more than a few frames per hop.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <poll.h>
+#include "test.h"
+#include "../daemon/hopper.h"
+#include "../daemon/dedup.h"
+#include "../daemon/transport.h"
+#include "../gamepad.h"
+#include "../hop.h"
+
+#define MS          1000000ULL
+/* one evaluation period, blacklist changes right after it */
+#define EVAL_MS     (HOPPER_EVAL_DWELLS * HOP_DWELL_MS)
+#define PAROLE      HOPPER_PAROLE
+
+/* channels 42, 47, 52 and 57 of the sequence lose most frames */
+#define LOSSY_FIRST 40
+#define LOSSY_LAST  60
+
+/* visits to lossy and clean channels while blacklist is in force and after */
+static int lossy_before = 0, lossy_during = 0, lossy_after = 0;
+static int clean_during = 0;
+/* frames controller sent but receiver missed while blacklist is in force */
+static int missed_during = 0;
+
+
+static int lossy(int channel)
+{
+	return channel >= LOSSY_FIRST && channel <= LOSSY_LAST;
+}
+
+/* blacklist in force and its first hops done */
+static int during(uint64_t now)
+{
+	uint64_t t = now / MS;
+	return t > EVAL_MS + HOP_DWELL_MS && t < (1 + PAROLE) * EVAL_MS;
+}
+
+static void visit(int channel, uint64_t now)
+{
+	/* skip dwells right at evaluation, hop decided then is still from before */
+	uint64_t t = now / MS;
+
+	if (t < EVAL_MS) {
+		lossy_before += lossy(channel);
+	} else if (during(now)) {
+		lossy_during += lossy(channel);
+		clean_during += !lossy(channel);
+	} else if (t > (1 + PAROLE) * EVAL_MS + HOP_DWELL_MS && t < (2 + PAROLE) * EVAL_MS) {
+		lossy_after += lossy(channel);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct transport *t = &transport_sim;
+	struct transport_opts opts = { .pipes = 1, .data_rate = 2000, .rate = 1e6, .hop_seed = 0x1234 };
+	uint64_t now = MS, end = (3 + PAROLE) * EVAL_MS * MS;
+	uint8_t last_seq = 0;
+	int first = 1, frames = 0;
+
+	opts.channel = hopper_init(opts.hop_seed, now);
+	t->fd = -1;
+	CHECK(t->open(t, "gen:40-60=60", &opts) == 0, "open simulated radio");
+
+	while (now < end && !test_failures) {
+		struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+		struct gamepad_state gs;
+		struct frame f;
+		uint8_t beacon[HOP_BEACON_SIZE];
+		int n, missed, ch, gap;
+
+		n = t->recv(t, &f);
+		if (n == 0) {
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (n < 0 || gamepad_decode(f.data, f.len, &gs) < 0) {
+			CHECK(0, "simulated radio failed or generated invalid frame");
+			break;
+		}
+
+		/* acknowledgement of next frame tells where receiver is */
+		t->ack(t, f.pipe, beacon, (uint8_t)hopper_beacon(beacon));
+
+		/* frames that were not received took their time too */
+		gap = first ? 1 : (uint8_t)(gs.seq - last_seq);
+		now += gap * MS;
+		last_seq = gs.seq;
+		first = 0;
+		frames++;
+		if (during(now)) {
+			missed_during += gap - 1;
+		}
+
+		hopper_seen(gs.id, now);
+		if (dedup_check(gs.id, gs.seq, now, &missed) == DEDUP_ACCEPT) {
+			hopper_count(gs.id, missed);
+		}
+		ch = hopper_run(now);
+		if (ch >= 0) {
+			opts.channel = ch;
+			t->reconf(t, &opts);
+			visit(ch, now);
+		}
+	}
+	t->close(t);
+	hopper_print();
+
+	CHECK(lossy_before > 0, "lossy channels not visited before first evaluation");
+	CHECK(lossy_during == 0, "%d visits to lossy channels while blacklisted", lossy_during);
+	CHECK(clean_during >= (HOP_CHANNELS - 4) * PAROLE * 2 - 2, "only %d visits to clean channels while lossy ones blacklisted",
+	      clean_during);
+	CHECK(lossy_after > 0, "lossy channels not back in use after parole");
+	/* one unacknowledged send per hop tells controller that receiver moved, allow twice that */
+	CHECK(missed_during <= PAROLE * HOPPER_EVAL_DWELLS * 2, "controller missed %d frames while blacklisted, lost receiver",
+	      missed_during);
+	printf("%d frames, %llu s virtual, lossy channel visits %d before, %d blacklisted, %d after parole, %d frames missed while blacklisted\n",
+	       frames, (unsigned long long)(now / 1000 / MS), lossy_before, lossy_during, lossy_after, missed_during);
+
+	return test_result("hopper");
+}
@@ -0,0 +1,121 @@
+/*
+ * NES/SNES reader against simulated shift register
+ *
+ * Checks bit order, type detection including unplugged controller and
+ * that data is only sampled while clock is low, one latch pulse and one
+ * rising edge per bit.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include "test.h"
+#include "../pad/nes.h"
+#include "../gamepad.h"
+
+
+static void check_timing(int bits, const char *what)
+{
+	struct nes_sim_stats ss;
+
+	nes_sim_stats(&ss);
+	CHECK(ss.latches == 1, "%s: %d latches", what, ss.latches);
+	CHECK(ss.clocks == bits, "%s: %d clocks for %d bits", what, ss.clocks, bits);
+	CHECK(ss.reads == bits, "%s: %d reads for %d bits", what, ss.reads, bits);
+	CHECK(ss.reads_clock_high == 0, "%s: %d reads with clock high", what, ss.reads_clock_high);
+}
+
+static void test_bit_order(int bits)
+{
+	for (int i = 0; i < bits; i++) {
+		uint16_t b;
+		nes_sim_set(1 << i, bits);
+		b = nes_read(bits);
+		CHECK(b == (1 << i), "%d bit read, button %d pressed, got 0x%04x", bits, i, b);
+		check_timing(bits, "nes_read()");
+	}
+}
+
+static void test_nes(void)
+{
+	uint16_t pressed = GAMEPAD_BTN_A | GAMEPAD_BTN_START | GAMEPAD_BTN_RIGHT, b = 0;
+	int type;
+
+	/* nes register is 8 bits, ground shifted in after it reads as pressed */
+	nes_sim_set(pressed, 8);
+	type = nes_scan(&b);
+	CHECK(type == NES_TYPE_NES, "type %d", type);
+	CHECK(b == pressed, "nes buttons 0x%04x, expected 0x%04x", b, pressed);
+	check_timing(NES_SCAN_BITS, "nes scan");
+
+	nes_sim_set(0, 8);
+	type = nes_scan(&b);
+	CHECK(type == NES_TYPE_NES && b == 0, "released nes: type %d buttons 0x%04x", type, b);
+	check_timing(NES_SCAN_BITS, "released nes scan");
+}
+
+static void test_snes(void)
+{
+	/* snes shift order B, Y, select, start, up, down, left, right, A, X, L, R */
+	uint16_t expected = GAMEPAD_BTN_B | GAMEPAD_BTN_Y | GAMEPAD_BTN_UP | GAMEPAD_BTN_A | GAMEPAD_BTN_R, b = 0;
+	int type;
+
+	nes_sim_set(0x0001 | 0x0002 | 0x0010 | 0x0100 | 0x0800, 16);
+	type = nes_scan(&b);
+	CHECK(type == NES_TYPE_SNES, "type %d", type);
+	CHECK(b == expected, "snes buttons 0x%04x, expected 0x%04x", b, expected);
+	check_timing(NES_SCAN_BITS, "snes scan");
+
+	/* released snes reads all 16 bits high like nothing connected, bit after them differs */
+	nes_sim_set(0, 16);
+	type = nes_scan(&b);
+	CHECK(type == NES_TYPE_SNES && b == 0, "released snes: type %d buttons 0x%04x", type, b);
+	check_timing(NES_SCAN_BITS, "released snes scan");
+}
+
+static void test_none(void)
+{
+	uint16_t b = 0xffff;
+	int type;
+
+	nes_sim_set(0, 0);
+	type = nes_scan(&b);
+	CHECK(type == NES_TYPE_NONE && b == 0, "unplugged: type %d buttons 0x%04x", type, b);
+	check_timing(NES_SCAN_BITS, "unplugged scan");
+}
+
+static void test_scan_stats(void)
+{
+	struct nes_scan_stats st;
+	struct nes_sim_stats ss;
+	uint16_t b;
+
+	nes_scan_stats(&st);
+	for (int i = 0; i < 10; i++) {
+		nes_scan(&b);
+	}
+	nes_scan_stats(&st);
+	CHECK(st.count == 10, "%u scans", st.count);
+	CHECK(st.us_min <= st.us_max, "min %u us, max %u us", st.us_min, st.us_max);
+	CHECK(st.us_total >= st.us_max, "total %llu us, max %u us", (unsigned long long)st.us_total, st.us_max);
+	nes_sim_stats(&ss);
+	CHECK(ss.latches == 10 && ss.clocks == 10 * NES_SCAN_BITS, "%d latches and %d clocks for 10 scans", ss.latches, ss.clocks);
+
+	/* reset by reading */
+	nes_scan_stats(&st);
+	CHECK(st.count == 0 && st.us_min == 0, "after reset %u scans, min %u us", st.count, st.us_min);
+}
+
+int main(int argc, char *argv[])
+{
+	CHECK(nes_open(0, 1, 2) == 0, "open");
+	test_bit_order(8);
+	test_bit_order(16);
+	test_nes();
+	test_snes();
+	test_none();
+	test_scan_stats();
+	nes_close();
+
+	return test_result("nes");
+}
@@ -0,0 +1,266 @@
+/*
+ * Timer wheel and silent controller handling
+ *
+ * Checks that timers fire once and never early, also after sleeping past
+ * a full revolution, that a timer can rearm itself from its callback and
+ * that a silent controller is released first and returned later, also
+ * when it is fed by frames from the simulated radio.
+ *
+ * Authors:
+ *  Antti Partanen <aehparta@iki.fi>
+ */
+
+#include <string.h>
+#include <poll.h>
+#include "test.h"
+#include "../daemon/wheel.h"
+#include "../daemon/reap.h"
+#include "../daemon/metrics.h"
+#include "../daemon/transport.h"
+#include "../gamepad.h"
+
+/* reap counts into these, normally in metrics.c */
+struct metrics_rx metrics_rx;
+struct metrics_emit metrics_emit;
+
+#define MS      1000000ULL
+#define TICK    (REAP_TICK_MS * MS)
+
+
+static int fired = 0;
+static uint64_t fired_at = 0;
+
+static void count_cb(struct wheel_timer *timer, uint64_t now)
+{
+	fired++;
+	fired_at = now;
+}
+
+static struct wheel rearm_wheel;
+static int rearm_left = 0;
+
+static void rearm_cb(struct wheel_timer *timer, uint64_t now)
+{
+	fired++;
+	fired_at = now;
+	if (--rearm_left > 0) {
+		/* past time must not fire again during the same run */
+		wheel_add(&rearm_wheel, timer, now - TICK);
+	}
+}
+
+static void test_wheel_basic(void)
+{
+	struct wheel w;
+	struct wheel_timer t = { .cb = count_cb };
+	int n;
+
+	wheel_init(&w, TICK, 0);
+	fired = 0;
+	wheel_add(&w, &t, 35 * MS);
+	CHECK(wheel_armed(&w) == 1, "%d armed", wheel_armed(&w));
+
+	/* rounded up to next tick, not early, running same tick again is fine */
+	n = wheel_run(&w, 39 * MS);
+	CHECK(n == 0 && fired == 0, "expired %d, fired %d before due", n, fired);
+	n = wheel_run(&w, 38 * MS);
+	CHECK(n == 0 && fired == 0, "expired %d, fired %d on same tick again", n, fired);
+	n = wheel_run(&w, 40 * MS);
+	CHECK(n == 1 && fired == 1, "expired %d, fired %d when due", n, fired);
+	CHECK(wheel_armed(&w) == 0, "%d armed after expiry", wheel_armed(&w));
+	n = wheel_run(&w, 100 * MS);
+	CHECK(n == 0 && fired == 1, "expired %d, fired %d after expiry", n, fired);
+
+	/* disarmed timer does not fire */
+	wheel_add(&w, &t, 200 * MS);
+	wheel_del(&w, &t);
+	n = wheel_run(&w, 300 * MS);
+	CHECK(n == 0 && fired == 1 && wheel_armed(&w) == 0, "expired %d, fired %d after delete", n, fired);
+}
+
+static void test_wheel_long(void)
+{
+	struct wheel w;
+	struct wheel_timer near = { .cb = count_cb }, far = { .cb = count_cb };
+	uint64_t rev = WHEEL_SLOTS * TICK;
+	int n;
+
+	/* far timer shares slot with near one but is three revolutions later */
+	wheel_init(&w, TICK, 0);
+	fired = 0;
+	wheel_add(&w, &near, 5 * TICK);
+	wheel_add(&w, &far, 5 * TICK + 3 * rev);
+	n = wheel_run(&w, 5 * TICK);
+	CHECK(n == 1 && fired == 1, "expired %d, fired %d on first revolution", n, fired);
+	n = wheel_run(&w, 5 * TICK + 2 * rev);
+	CHECK(n == 0 && fired == 1, "expired %d, fired %d revolution before due", n, fired);
+
+	/* sleep over several revolutions, due timer must still be found */
+	n = wheel_run(&w, 5 * TICK + 10 * rev);
+	CHECK(n == 1 && fired == 2, "expired %d, fired %d after long sleep", n, fired);
+	CHECK(fired_at == 5 * TICK + 10 * rev, "fired at %llu", (unsigned long long)fired_at);
+
+	/* timer armed just before long sleep, slot is behind wheel position when woken */
+	wheel_add(&w, &near, 5 * TICK + 10 * rev + 3 * TICK);
+	n = wheel_run(&w, 5 * TICK + 20 * rev + 100 * TICK);
+	CHECK(n == 1 && fired == 3, "expired %d, fired %d for timer overslept", n, fired);
+	CHECK(wheel_armed(&w) == 0, "%d armed", wheel_armed(&w));
+}
+
+static void test_wheel_rearm(void)
+{
+	struct wheel_timer t = { .cb = rearm_cb };
+	int n;
+
+	wheel_init(&rearm_wheel, TICK, 0);
+	fired = 0;
+	rearm_left = 3;
+	wheel_add(&rearm_wheel, &t, 10 * TICK);
+
+	/* rearmed into the past goes to next tick, not into this run */
+	n = wheel_run(&rearm_wheel, 10 * TICK);
+	CHECK(n == 1 && fired == 1, "expired %d, fired %d on first run", n, fired);
+	CHECK(wheel_armed(&rearm_wheel) == 1, "%d armed after rearm", wheel_armed(&rearm_wheel));
+	n = wheel_run(&rearm_wheel, 11 * TICK);
+	CHECK(n == 1 && fired == 2, "expired %d, fired %d on second run", n, fired);
+	n = wheel_run(&rearm_wheel, 12 * TICK);
+	CHECK(n == 1 && fired == 3, "expired %d, fired %d on third run", n, fired);
+	CHECK(wheel_armed(&rearm_wheel) == 0, "%d armed after last", wheel_armed(&rearm_wheel));
+	n = wheel_run(&rearm_wheel, 100 * TICK);
+	CHECK(n == 0 && fired == 3, "expired %d, fired %d after last", n, fired);
+}
+
+static int reap_calls[3];
+static uint64_t reap_at[3];
+static uint8_t reap_id = 3;
+
+static void reap_test_cb(uint8_t id, int what, uint64_t now)
+{
+	CHECK(id == reap_id, "callback for controller %u", id);
+	CHECK(what == REAP_RELEASE || what == REAP_IDLE, "callback what %d", what);
+	reap_calls[what]++;
+	reap_at[what] = now;
+}
+
+/* run reap every tick like receiver would, up to given time */
+static void reap_until(uint64_t *now, uint64_t until)
+{
+	for (; *now <= until; *now += TICK) {
+		reap_run(*now);
+	}
+	*now -= TICK;
+}
+
+static void test_reap(void)
+{
+	uint64_t now = 0;
+
+	reap_init(500, 2000, reap_test_cb, now);
+	CHECK(!reap_pending(), "pending before first contact");
+
+	/* frames keep it alive, timer is rearmed from last contact */
+	for (; now <= 1000 * MS; now += TICK) {
+		reap_seen(3, now);
+		reap_run(now);
+	}
+	now -= TICK;
+	CHECK(reap_pending(), "not pending while active");
+	CHECK(reap_calls[REAP_RELEASE] == 0 && reap_calls[REAP_IDLE] == 0, "callbacks while active: %d release %d idle",
+	      reap_calls[REAP_RELEASE], reap_calls[REAP_IDLE]);
+
+	/* silent: released after 500 ms, returned after 2000 ms */
+	reap_until(&now, 1000 * MS + 499 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 0, "released after %llu ms silence", (unsigned long long)((now - 1000 * MS) / MS));
+	reap_until(&now, 1000 * MS + 510 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 1 && reap_at[REAP_RELEASE] == 1500 * MS, "%d releases, at %llu ms",
+	      reap_calls[REAP_RELEASE], (unsigned long long)(reap_at[REAP_RELEASE] / MS));
+	CHECK(reap_calls[REAP_IDLE] == 0, "returned together with release");
+	reap_until(&now, 1000 * MS + 1990 * MS);
+	CHECK(reap_calls[REAP_IDLE] == 0, "returned after %llu ms silence", (unsigned long long)((now - 1000 * MS) / MS));
+	reap_until(&now, 1000 * MS + 2010 * MS);
+	CHECK(reap_calls[REAP_IDLE] == 1 && reap_at[REAP_IDLE] == 3000 * MS, "%d returns, at %llu ms",
+	      reap_calls[REAP_IDLE], (unsigned long long)(reap_at[REAP_IDLE] / MS));
+	CHECK(!reap_pending(), "pending after return");
+	CHECK(METRICS_LOAD(metrics_rx.counters[METRICS_RX_RELEASED]) == 1 &&
+	      METRICS_LOAD(metrics_rx.counters[METRICS_RX_IDLED]) == 1, "counters %llu released %llu idled",
+	      (unsigned long long)METRICS_LOAD(metrics_rx.counters[METRICS_RX_RELEASED]),
+	      (unsigned long long)METRICS_LOAD(metrics_rx.counters[METRICS_RX_IDLED]));
+
+	/* back after release but before idle, starts over */
+	reap_seen(3, now);
+	reap_until(&now, now + 400 * MS);
+	reap_seen(3, now);
+	reap_until(&now, now + 510 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 2 && reap_calls[REAP_IDLE] == 1, "%d releases %d returns after comeback",
+	      reap_calls[REAP_RELEASE], reap_calls[REAP_IDLE]);
+	reap_seen(3, now);
+	reap_until(&now, now + 100 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 2 && reap_calls[REAP_IDLE] == 1, "%d releases %d returns when back",
+	      reap_calls[REAP_RELEASE], reap_calls[REAP_IDLE]);
+
+	/* one long sleep past both timeouts, return is due by next tick at latest */
+	reap_run(now + 10000 * MS);
+	reap_run(now + 10000 * MS + TICK);
+	CHECK(reap_calls[REAP_RELEASE] == 3 && reap_calls[REAP_IDLE] == 2, "%d releases %d returns after long sleep",
+	      reap_calls[REAP_RELEASE], reap_calls[REAP_IDLE]);
+}
+
+/* one controller from simulated radio, virtual time of one millisecond per frame */
+static void test_reap_sim(void)
+{
+	struct transport *t = &transport_sim;
+	struct transport_opts opts = { .pipes = 1, .data_rate = 2000, .rate = 1e5 };
+	uint64_t now = 0, last = 0;
+	int frames = 0;
+
+	memset(reap_calls, 0, sizeof(reap_calls));
+	reap_id = 0;
+	reap_init(500, 2000, reap_test_cb, now);
+	t->fd = -1;
+	CHECK(t->open(t, "gen", &opts) == 0, "open simulated radio");
+
+	while (frames < 3000 && !test_failures) {
+		struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+		struct gamepad_state gs;
+		struct frame f;
+		int n = t->recv(t, &f);
+
+		if (n == 0) {
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (n < 0 || gamepad_decode(f.data, f.len, &gs) < 0) {
+			CHECK(0, "simulated radio failed or generated invalid frame");
+			break;
+		}
+		now += MS;
+		frames++;
+		reap_seen(gs.id, now);
+		reap_run(now);
+	}
+	t->close(t);
+	last = now;
+	CHECK(reap_calls[REAP_RELEASE] == 0 && reap_calls[REAP_IDLE] == 0, "%d releases %d returns while frames came",
+	      reap_calls[REAP_RELEASE], reap_calls[REAP_IDLE]);
+
+	/* frames stopped, receiver keeps running the reaper */
+	reap_until(&now, last + 490 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 0, "released %llu ms after last frame", (unsigned long long)((reap_at[REAP_RELEASE] - last) / MS));
+	reap_until(&now, last + 2100 * MS);
+	CHECK(reap_calls[REAP_RELEASE] == 1 && reap_at[REAP_RELEASE] - last >= 500 * MS && reap_at[REAP_RELEASE] - last < 500 * MS + 2 * TICK,
+	      "%d releases, %llu ms after last frame", reap_calls[REAP_RELEASE], (unsigned long long)((reap_at[REAP_RELEASE] - last) / MS));
+	CHECK(reap_calls[REAP_IDLE] == 1 && reap_at[REAP_IDLE] - last >= 2000 * MS && reap_at[REAP_IDLE] - last < 2000 * MS + 2 * TICK,
+	      "%d returns, %llu ms after last frame", reap_calls[REAP_IDLE], (unsigned long long)((reap_at[REAP_IDLE] - last) / MS));
+	CHECK(!reap_pending(), "pending after return");
+}
+
+int main(int argc, char *argv[])
+{
+	test_wheel_basic();
+	test_wheel_long();
+	test_wheel_rearm();
+	test_reap();
+	test_reap_sim();
+
+	return test_result("timers");
+}